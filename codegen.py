@@ -29,9 +29,62 @@ def declare_device(output,header):
   print("static dd_device device = {",file=output)
   print("\t.endpoints = endpoints,",file=output)
   print("\t.endpoints_length = sizeof(endpoints) / sizeof(dd_endpoint *),",file=output)
+  print("\t.endpoints_cbor = endpoints_cbor,",file=output)
+  print("\t.endpoints_cbor_length = sizeof(endpoints_cbor),",file=output)
+  print("\t.routes = routes,",file=output)
+  print("\t.routes_length = sizeof(routes) / sizeof(dd_route),",file=output)
   print("};",file=output)
   print("dd_device *__device = &device;",file=output)
 
+def cbor_head(major,value):
+  if value < 24:
+    return [major << 5 | value]
+  for info,size in [(24,1),(25,2),(26,4),(27,8)]:
+    if value < 1 << (8 * size):
+      return [major << 5 | info] + list(value.to_bytes(size, "big"))
+
+def cbor_uint_array(values):
+  result = cbor_head(4,len(values))
+  for value in values:
+    result += cbor_head(0,value)
+  return result
+
+def cbor_string_array(values):
+  result = cbor_head(4,len(values))
+  for value in values:
+    result += cbor_head(3,len(value.encode())) + list(value.encode())
+  return result
+
+def declare_cbor(output,name,comment,data):
+  print(file=output)
+  print("// %s (cbor)"% (comment),file=output)
+  print("static const uint8_t %s[%i] = {%s};"% (name,len(data),", ".join("0x%02x"% (byte) for byte in data)),file=output)
+
+def add_route(routes,eid,role="\0",cl=0,sub="\0",id=0,leaf=None):
+  # same bit layout as DD_ROUTE_KEY in dd_types.h
+  key = (eid << 48) | (ord(role[0]) << 40) | (cl << 24) | (ord(sub) << 16) | id
+  routes.append((key,eid,role[0],cl,sub,id,leaf))
+
+def declare_route_list(output,header,routes):
+  def char(c):
+    return "'%c'"% (c) if c != "\0" else "0"
+
+  print(file=output)
+  print("// routes (sorted by key)",file=output)
+  print("static dd_route routes[%i] = {"% (len(routes)),file=output)
+  for key,eid,role,cl,sub,id,leaf in sorted(routes):
+    print("\t{",file=output)
+    print("\t\t.key = DD_ROUTE_KEY(0x%x, %s, 0x%x, %s, 0x%x),"% (eid,char(role),cl,char(sub),id),file=output)
+    print("\t\t.endpoint = &endpoint_%x,"% (eid),file=output)
+    if role != "\0":
+      print("\t\t.cluster = &endpoint_%x_cluster_%c%x,"% (eid,role,cl),file=output)
+    if sub == "a":
+      print("\t\t.attribute = &%s,"% (leaf),file=output)
+    if sub == "c":
+      print("\t\t.command = &%s,"% (leaf),file=output)
+    print("\t},",file=output)
+  print("};",file=output)
+
 def declare_endpoint(output,header,eid):
   print(file=output)
   print("// endpoint %x"% (eid),file=output)
@@ -39,10 +92,14 @@ def declare_endpoint(output,header,eid):
   print("\t.id = 0x%x,"% (eid),file=output)
   print("\t.cluster = endpoint_%x_cluster,"% (eid),file=output)
   print("\t.cluster_length = sizeof(endpoint_%x_cluster) / sizeof(dd_cluster *),"% (eid),file=output)
+  print("\t.cluster_cbor = endpoint_%x_cluster_cbor,"% (eid),file=output)
+  print("\t.cluster_cbor_length = sizeof(endpoint_%x_cluster_cbor),"% (eid),file=output)
   print("};",file=output)
   return ("endpoint_%x"% (eid))
 
-def declare_endpoint_list(output,header,endpoints):
+def declare_endpoint_list(output,header,endpoints,eids):
+  declare_cbor(output,"endpoints_cbor","endpoints",cbor_uint_array(eids))
+
   print(file=output)
   print("// endpoints",file=output)
   print("static dd_endpoint *endpoints[%i] = {"% (len(endpoints)),file=output)
@@ -63,17 +120,23 @@ def declare_cluster(output,header,eid,cl,role):
   print("\t.manufacturer = %i,"% (0),file=output)
   print("\t.attributes = endpoint_%x_cluster_%c%x_attributes,"% (eid,role[0],cl),file=output)
   print("\t.attributes_length = sizeof(endpoint_%x_cluster_%c%x_attributes) / sizeof(dd_attribute *),"% (eid,role[0],cl),file=output)
+  print("\t.attributes_cbor = endpoint_%x_cluster_%c%x_attributes_cbor,"% (eid,role[0],cl),file=output)
+  print("\t.attributes_cbor_length = sizeof(endpoint_%x_cluster_%c%x_attributes_cbor),"% (eid,role[0],cl),file=output)
   print("\t.bindings = {0},",file=output)
   print("\t.bindings_length = 0,",file=output)
   print("\t.commands = endpoint_%x_cluster_%c%x_commands,"% (eid,role[0],cl),file=output)
   print("\t.commands_length = sizeof(endpoint_%x_cluster_%c%x_commands) / sizeof(dd_command *),"% (eid,role[0],cl),file=output)
+  print("\t.commands_cbor = endpoint_%x_cluster_%c%x_commands_cbor,"% (eid,role[0],cl),file=output)
+  print("\t.commands_cbor_length = sizeof(endpoint_%x_cluster_%c%x_commands_cbor),"% (eid,role[0],cl),file=output)
   print("\t.reports = {0},",file=output)
   print("\t.reports_length = 0,",file=output)
   print("\t.notify = endpoint_%x_cluster_%c%x_handle_notification,"% (eid,role[0],cl),file=output)
   print("};",file=output)
   return ("endpoint_%x_cluster_%c%x"% (eid,role[0],cl))
 
-def declare_cluster_list(output,header,eid,cluster):
+def declare_cluster_list(output,header,eid,cluster,names):
+  declare_cbor(output,"endpoint_%x_cluster_cbor"% (eid),"endpoint 0x%x cluster"% (eid),cbor_string_array(names))
+
   print(file=output)
   print("// endpoint 0x%x cluster"% (eid),file=output)
   print("static dd_cluster *endpoint_%x_cluster[%i] = {"% (eid,len(cluster)),file=output)
@@ -81,18 +144,19 @@ def declare_cluster_list(output,header,eid,cluster):
     print("\t&%s,"% cluster_,file=output)
   print("};",file=output)
 
+signatures={ # this is a shortcut, ZCL schema does declare each type in detail ...
+  "bool": "bool ",
+  "int8": "int8_t ",
+  "int16": "int16_t ",
+  "int32": "int32_t ",
+  "uint8": "uint8_t ",
+  "uint16": "uint16_t ",
+  "uint32": "uint32_t ",
+  "string": "const char *",
+  "UTC": "time_t ",
+}
+
 def declare_attribute_handler(output,header,eid,cl,role,aid,name,type):
-  signatures={ # this is a shortcut, ZCL schema does declare each type in detail ...
-    "bool": "bool ",
-    "int8": "int8_t ",
-    "int16": "int16_t ",
-    "int32": "int32_t ",
-    "uint8": "uint8_t ",
-    "uint16": "uint16_t ",
-    "uint32": "uint32_t ",
-    "string": "const char *",
-    "UTC": "time_t ",
-  }
   print(file=header)
   print("// endpoint %x cluster %c%x attribute %x read+write handler"% (eid,role[0],cl,aid),file=header)
   print("%sendpoint_%x_cluster_%c%x_attribute_%x_handle_read();"% (signatures[type],eid,role[0],cl,aid),file=header)
@@ -111,18 +175,45 @@ def declare_attribute_handler(output,header,eid,cl,role,aid,name,type):
   print("\tendpoint_%x_cluster_%c%x_attribute_%x_handle_write(arg);"% (eid,role[0],cl,aid),file=output)
   print("};",file=output)
 
-def declare_attribute(output,header,eid,cl,role,aid,name):
+def declare_attribute(output,header,eid,cl,role,aid,name,type):
+  value_types={ # wire type and range accepted by the write handler
+    "bool": ("DD_BOOL",0,0),
+    "int8": ("DD_INT",-0x80,0x7f),
+    "int16": ("DD_INT",-0x8000,0x7fff),
+    "int32": ("DD_INT",-0x80000000,0x7fffffff),
+    "uint8": ("DD_UINT",0,0xff),
+    "uint16": ("DD_UINT",0,0xffff),
+    "uint32": ("DD_UINT",0,0xffffffff),
+    "string": ("DD_STRING",0,0),
+    "UTC": ("DD_TIME",0,0),
+  }
   print(file=output)
   print("// endpoint %x cluster %c%x attribute %x"% (eid,role[0],cl,aid),file=output)
   print("static dd_attribute endpoint_%x_cluster_%c%x_attribute_%x = {"% (eid,role[0],cl,aid),file=output)
   print("\t.id = 0x%x,"% (aid),file=output)
   print("\t.name = \"%s\","% (name),file=output)
+  print("\t.type = %s,"% (value_types[type][0]),file=output)
+  print("\t.min = %i,"% (value_types[type][1]),file=output)
+  print("\t.max = %i,"% (value_types[type][2]),file=output)
   print("\t.read = endpoint_%x_cluster_%c%x_attribute_%x_handle_read_wrapper,"% (eid,role[0],cl,aid),file=output)
   print("\t.write = endpoint_%x_cluster_%c%x_attribute_%x_handle_write_wrapper,"% (eid,role[0],cl,aid),file=output)
   print("};",file=output)
+
+  print(file=header)
+  print("// endpoint %x cluster %c%x attribute %x value changed, updates cache"% (eid,role[0],cl,aid),file=header)
+  print("void endpoint_%x_cluster_%c%x_attribute_%x_changed(%svalue);"% (eid,role[0],cl,aid,signatures[type]),file=header)
+
+  print(file=output)
+  print("// endpoint %x cluster %c%x attribute %x value changed"% (eid,role[0],cl,aid),file=output)
+  print("void endpoint_%x_cluster_%c%x_attribute_%x_changed(%svalue) {"% (eid,role[0],cl,aid,signatures[type]),file=output)
+  print("\tchar buffer[DD_ATTRIBUTE_CACHE_SIZE];",file=output)
+  print("\tdd_attribute_changed(&endpoint_%x_cluster_%c%x_attribute_%x, dd_%s_to_value(value, buffer, sizeof(buffer)));"% (eid,role[0],cl,aid,type),file=output)
+  print("};",file=output)
   return ("endpoint_%x_cluster_%c%x_attribute_%x"% (eid,role[0],cl,aid))
 
-def declare_attribute_list(output,header,eid,cl,role,attributes):
+def declare_attribute_list(output,header,eid,cl,role,attributes,aids):
+  declare_cbor(output,"endpoint_%x_cluster_%c%x_attributes_cbor"% (eid,role[0],cl),"endpoint 0x%x cluster %c%x attributes"% (eid,role[0],cl),cbor_uint_array(aids))
+
   print(file=output)
   print("// endpoint 0x%x cluster %c%x attributes"% (eid,role[0],cl),file=output)
   print("static dd_attribute *endpoint_%x_cluster_%c%x_attributes[%i] = {"% (eid,role[0],cl,len(attributes)),file=output)
@@ -143,7 +234,9 @@ def declare_command(output,header,eid,cl,role,cid):
   print("};",file=output)
   return ("endpoint_%x_cluster_%c%x_command_%x"% (eid,role[0],cl,cid))
 
-def declare_command_list(output,header,eid,cl,role,commands):
+def declare_command_list(output,header,eid,cl,role,commands,cids):
+  declare_cbor(output,"endpoint_%x_cluster_%c%x_commands_cbor"% (eid,role[0],cl),"endpoint 0x%x cluster %c%x commands"% (eid,role[0],cl),cbor_uint_array(cids))
+
   print(file=output)
   print("// endpoint 0x%x cluster %c%x commands"% (eid,role[0],cl),file=output)
   print("static dd_command *endpoint_%x_cluster_%c%x_commands[%i] = {"% (eid,role[0],cl,len(commands)),file=output)
@@ -172,16 +265,20 @@ outheader = open(args.header, 'w')
 header(outsource,outheader,input)
 
 endpoint_declarations = []
+endpoint_ids = []
+routes = []
 for endpoint in app["endpoint"]:
   eid = endpoint["@id"]
 
   cluster_declarations = []
+  cluster_names = []
   for cluster in endpoint["zcl:cluster"]:
     cl = int(cluster["@id"], base=16)
 
     for role in ["client", "server"]:
       if role in cluster:
         attribute_declarations = []
+        attribute_ids = []
         if "attributes" in cluster[role]:
           for attribute in cluster[role]["attributes"]["attribute"]:
             aid = int(attribute["@id"], base=16)
@@ -190,26 +287,39 @@ for endpoint in app["endpoint"]:
 
             declare_attribute_handler(outsource,outheader,eid,cl,role,aid,name,type)
 
-            attribute_declarations.append(declare_attribute(outsource,outheader,eid,cl,role,aid,name))
+            attribute_declarations.append(declare_attribute(outsource,outheader,eid,cl,role,aid,name,type))
+            attribute_ids.append(aid)
+            add_route(routes,eid,role,cl,"a",aid,attribute_declarations[-1])
 
-        declare_attribute_list(outsource,outheader,eid,cl,role,attribute_declarations)
+        # sort attributes by id, so that lookups and range queries can bisect
+        attribute_ids,attribute_declarations = zip(*sorted(zip(attribute_ids,attribute_declarations))) if attribute_ids else ([],[])
+        declare_attribute_list(outsource,outheader,eid,cl,role,attribute_declarations,attribute_ids)
 
         command_declarations = []
+        command_ids = []
         if "commands" in cluster[role]:
           for command in cluster[role]["commands"]["command"]:
             cid = int(command["@id"], base=16)
 
             command_declarations.append(declare_command(outsource,outheader,eid,cl,role,cid))
+            command_ids.append(cid)
+            add_route(routes,eid,role,cl,"c",cid,command_declarations[-1])
 
-        declare_command_list(outsource,outheader,eid,cl,role,command_declarations)
+        declare_command_list(outsource,outheader,eid,cl,role,command_declarations,command_ids)
 
         cluster_declarations.append(declare_cluster(outsource,outheader,eid,cl,role))
+        cluster_names.append("%c%x"% (role[0],cl)) # manufacturer specific clusters would append "_<manufacturer>"
+        add_route(routes,eid,role,cl)
 
-  declare_cluster_list(outsource,outheader,eid,cluster_declarations)
+  declare_cluster_list(outsource,outheader,eid,cluster_declarations,cluster_names)
 
   endpoint_declarations.append(declare_endpoint(outsource,outheader,eid))
+  endpoint_ids.append(eid)
+  add_route(routes,eid)
+
+declare_endpoint_list(outsource,outheader,endpoint_declarations,endpoint_ids)
 
-declare_endpoint_list(outsource,outheader,endpoint_declarations)
+declare_route_list(outsource,outheader,routes)
 
 declare_device(outsource,outheader)
 
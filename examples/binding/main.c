@@ -13,6 +13,10 @@ static volatile int exit_ = 0;
 void on_signal(int s) { exit_ = 1; }
 
 int main(int argc, char *argv[]) {
+  // leave main loop on shutdown, see on_signal
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
   // start dotdot
   dd_init();
   dd_start();
@@ -30,6 +34,9 @@ int main(int argc, char *argv[]) {
       break;
   }
 
+  // persist volatile state
+  dd_checkpoint();
+
   // exit
   return 0;
 }
@@ -55,8 +62,9 @@ static const char *uri_scheme_tostr(dd_scheme scheme) {
 void endpoint_1_cluster_s3_handle_notification(dd_notification *notification) {
   printf("Received notification:\n");
   printf("\tsender uri: %s//%s:%u%s\n",
-         uri_scheme_tostr(notification->uri->scheme), notification->uri->host,
-         notification->uri->port, notification->uri->path);
+         uri_scheme_tostr(notification->uri->scheme),
+         dd_uri_host(notification->uri), notification->uri->port,
+         dd_uri_path(notification->uri));
   printf("\tbinding id: %u\n", notification->bid);
   printf("\treport id: %u\n", notification->rid);
   printf("\ttimestamp: %s", asctime(gmtime(&notification->timestamp)));
@@ -30,3 +30,8 @@ eexec coap-client -m get coap://[::1]/zcl/e/1/s3/b/1 | decode
 # cbor.me: {"r": 1,"u": "coap://localhost:1234/"}
 printf "\xA2\x61\x72\x01\x61\x75\x76coap://localhost:1234/" | eexec coap-client -m post -f - coap://[::1]/zcl/e/1/s3/b
 eexec coap-client -m get coap://[::1]/zcl/e/1/s3/b/2 | decode
+
+# create confirmable binding to self
+# cbor.me: {"r": 1,"u": "coap://localhost/zcl/e/1/s3/n","c": true}
+printf "\xA3\x61\x72\x01\x61\x75\x78\x1Dcoap://localhost/zcl/e/1/s3/n\x61\x63\xF5" | eexec coap-client -m post -f - coap://[::1]/zcl/e/1/s3/b
+eexec coap-client -m get coap://[::1]/zcl/e/1/s3/b/3 | decode
@@ -14,6 +14,10 @@ static volatile int exit_ = 0;
 void on_signal(int s) { exit_ = 1; }
 
 int main(int argc, char *argv[]) {
+  // leave main loop on shutdown, see on_signal
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
   // start dotdot
   dd_init();
   dd_start();
@@ -31,6 +35,9 @@ int main(int argc, char *argv[]) {
       break;
   }
 
+  // persist volatile state
+  dd_checkpoint();
+
   // exit
   return 0;
 }
@@ -23,6 +23,9 @@ eexec coap-client -m get coap://[::1]/zcl/e/1 | decode
 eexec coap-client -m get coap://[::1]/zcl/e/1/s2 | decode
 eexec coap-client -m get coap://[::1]/zcl/e/1/s2/a | decode
 
+# get filtered attribute values: 0, 2 to 4 and 2 attributes starting at 7
+eexec coap-client -m get "coap://[::1]/zcl/e/1/s2/a?f=0,2-4,7+2" | decode
+
 # get + set + get attributes
 
 # bool {1: true}
@@ -69,3 +72,16 @@ eexec coap-client -m get coap://[::1]/zcl/e/1/s2/a/7 | decode
 eexec coap-client -m get coap://[::1]/zcl/e/1/s2/a/8 | decode
 printf "\xA1\x08\xC1\x1A\x5F\x5F\xAD\x77" | eexec coap-client -m put -f - coap://[::1]/zcl/e/1/s2/a/8
 eexec coap-client -m get coap://[::1]/zcl/e/1/s2/a/8 | decode
+
+# mass update {0: false, 4: 200, 9: 1}, status per attribute (9 unsupported)
+printf "\xA3\x00\xF4\x04\x18\xC8\x09\x01" | eexec coap-client -m post -f - coap://[::1]/zcl/e/1/s2/a | decode
+eexec coap-client -m get "coap://[::1]/zcl/e/1/s2/a?f=0,4" | decode
+
+# observe attribute for 5 seconds while it is updated
+eexec coap-client -m get -s 5 coap://[::1]/zcl/e/1/s2/a/4 &
+sleep 1
+printf "\xA1\x04\x18\x64" | eexec coap-client -m put -f - coap://[::1]/zcl/e/1/s2/a/4
+wait
+
+# show etag of attribute, repeat GET with -O 4,<etag> to get 2.03 Valid
+eexec coap-client -m get -v 7 coap://[::1]/zcl/e/1/s2/a/4 2>&1 | grep -o "ETag:[^,]*"
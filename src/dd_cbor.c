@@ -25,7 +25,7 @@ void dd_cbor_add_value_key(QCBOREncodeContext *ctx, const char *key,
     QCBOREncode_AddUInt64ToMap(ctx, key, value->value.vuint);
     break;
   case DD_STRING:
-    QCBOREncode_AddSZStringToMap(ctx, key, value->value.vstring);
+    QCBOREncode_AddSZStringToMap(ctx, key, dd_value_to_string(value));
     break;
   case DD_TIME:
     QCBOREncode_AddDateEpochToMap(ctx, key, value->value.vtime);
@@ -51,7 +51,7 @@ void dd_cbor_add_value_keyn(QCBOREncodeContext *ctx, int64_t key,
     QCBOREncode_AddUInt64ToMapN(ctx, key, value->value.vuint);
     break;
   case DD_STRING:
-    QCBOREncode_AddSZStringToMapN(ctx, key, value->value.vstring);
+    QCBOREncode_AddSZStringToMapN(ctx, key, dd_value_to_string(value));
     break;
   case DD_TIME:
     QCBOREncode_AddDateEpochToMapN(ctx, key, value->value.vtime);
@@ -61,12 +61,14 @@ void dd_cbor_add_value_keyn(QCBOREncodeContext *ctx, int64_t key,
   }
 }
 
-void dd_cbor_add_uri_key(QCBOREncodeContext *ctx, const char *key,
-                         dd_uri *uri) {
-  assert(ctx != 0);
+/*
+ * format uri as string
+ */
+static void dd_cbor_format_uri(char *uri_str, size_t uri_str_size,
+                               dd_uri *uri) {
+  assert(uri_str != 0);
   assert(uri != 0);
   const char *scheme_str = 0;
-  char uri_str[1024];    // TODO: estimate maximum uri size
   char port_str[7] = {}; // ':' + uint16_max + '\0'
 
   // optional: <scheme:> prefix
@@ -89,14 +91,30 @@ void dd_cbor_add_uri_key(QCBOREncodeContext *ctx, const char *key,
     snprintf(port_str, sizeof(port_str), ":%u", uri->port);
 
   // generate string
-  size_t uri_str_len = snprintf(uri_str, sizeof(uri_str), "%s//%s%s%s",
-                                scheme_str, uri->host, port_str, uri->path);
-  assert(uri_str_len < sizeof(uri_str));
+  size_t uri_str_len = snprintf(uri_str, uri_str_size, "%s//%s%s%s",
+                                scheme_str, dd_uri_host(uri), port_str,
+                                dd_uri_path(uri));
+  assert(uri_str_len < uri_str_size);
+}
+
+void dd_cbor_add_uri_key(QCBOREncodeContext *ctx, const char *key,
+                         dd_uri *uri) {
+  assert(ctx != 0);
+  char uri_str[1024]; // TODO: estimate maximum uri size
 
   // add to cbor map
+  dd_cbor_format_uri(uri_str, sizeof(uri_str), uri);
   QCBOREncode_AddSZStringToMap(ctx, key, uri_str);
 }
 
+void dd_cbor_add_uri(QCBOREncodeContext *ctx, dd_uri *uri) {
+  assert(ctx != 0);
+  char uri_str[1024]; // TODO: estimate maximum uri size
+
+  dd_cbor_format_uri(uri_str, sizeof(uri_str), uri);
+  QCBOREncode_AddSZString(ctx, uri_str);
+}
+
 /*
  * get report attribute configuration item from cbor map
  *
@@ -143,13 +161,13 @@ dd_cbor_get_report_attribute_configuration(QCBORDecodeContext *ctx,
 
     switch (((const char *)item.label.string.ptr)[0]) {
     case 'h':
-      attribute_configuration->high_threshold = value;
+      dd_ref_set(&attribute_configuration->high_threshold, value);
       break;
     case 'l':
-      attribute_configuration->low_threshold = value;
+      dd_ref_set(&attribute_configuration->low_threshold, value);
       break;
     case 'r':
-      attribute_configuration->reportable_change = value;
+      dd_ref_set(&attribute_configuration->reportable_change, value);
       break;
     default:
       // unexpected key
@@ -282,9 +300,10 @@ dd_uri *dd_cbor_get_uri(QCBORItem *source, void *buffer, int buffer_size) {
     // buffer too small
     return 0;
   }
-  result->host = result->_buffer + result->length;
-  memcpy((char *)result->host, uri_host, uri_host_len);
-  ((char *)result->host)[uri_host_len] = '\0';
+  char *host = result->_buffer + result->length;
+  memcpy(host, uri_host, uri_host_len);
+  host[uri_host_len] = '\0';
+  dd_ref_set(&result->host, host);
   result->length += uri_host_len + 1;
   buffer_size -= uri_host_len + 1;
 
@@ -316,18 +335,19 @@ dd_uri *dd_cbor_get_uri(QCBORItem *source, void *buffer, int buffer_size) {
     // buffer too small
     return 0;
   }
-  result->path = result->_buffer + uri_host_len + 1;
-  memcpy((char *)result->path, uri_path, uri_path_len);
-  ((char *)result->path)[uri_path_len] = '\0';
+  char *path = result->_buffer + uri_host_len + 1;
+  memcpy(path, uri_path, uri_path_len);
+  path[uri_path_len] = '\0';
+  dd_ref_set(&result->path, path);
   result->length += uri_path_len + 1;
   buffer_size -= uri_path_len + 1;
 
   // done
-  assert(result->host >= result->_buffer);
-  assert(result->host < result->_buffer + result->length);
-  assert(result->path >= result->_buffer);
-  assert(result->path < result->_buffer + result->length);
-  assert(result->length == strlen(result->host) + strlen(result->path) + 2);
+  assert(host >= result->_buffer);
+  assert(host < result->_buffer + result->length);
+  assert(path >= result->_buffer);
+  assert(path < result->_buffer + result->length);
+  assert(result->length == strlen(host) + strlen(path) + 2);
   return result;
 }
 
@@ -362,7 +382,7 @@ dd_value *dd_cbor_get_value(QCBORItem *source, void *buffer, int buffer_size) {
     }
 
     value->type = DD_STRING;
-    value->value.vstring = value->_buffer;
+    dd_ref_set(&value->value.vstring, value->_buffer);
     memcpy(value->_buffer, source->val.string.ptr, source->val.string.len);
     value->_buffer[source->val.string.len] = 0;
     value->length = source->val.string.len + 1;
@@ -25,6 +25,9 @@ void dd_cbor_add_value_keyn(QCBOREncodeContext *ctx, int64_t key,
 // add uri to map with key
 void dd_cbor_add_uri_key(QCBOREncodeContext *ctx, const char *key, dd_uri *uri);
 
+// add uri, e.g. to pre-encode it
+void dd_cbor_add_uri(QCBOREncodeContext *ctx, dd_uri *uri);
+
 /*
  * get report attribute configuration items from cbor map
  *
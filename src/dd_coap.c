@@ -2,33 +2,311 @@
  * License, v. 2.0. If a copy of the MPL was not distributed with this
  * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
 #ifdef __linux__
+#define _GNU_SOURCE // getaddrinfo_a
 #include <netdb.h>
+#include <signal.h>
 #include <stdio.h>
 #endif
+#include <string.h>
 
 #include "dd_coap.h"
+#include "dd_types.h"
 
+/*
+ * Caching Resolver
+ */
 #ifdef __linux__
-int dd_coap_resolve(coap_address_t *address, const char *host, uint16_t port) {
-  assert(address != 0);
-  struct addrinfo *info;
-  struct addrinfo hints = {.ai_socktype = SOCK_DGRAM,
-                           .ai_family = AF_INET | AF_INET6};
+enum dd_coap_resolver_state {
+  DD_RESOLVER_FREE = 0,
+  DD_RESOLVER_PENDING, // lookup in progress
+  DD_RESOLVER_VALID,   // address valid until expiry
+  DD_RESOLVER_FAILED,  // negative entry, until expiry
+};
+typedef enum dd_coap_resolver_state dd_coap_resolver_state;
+
+struct dd_coap_resolver_entry {
+  dd_coap_resolver_state state;
+  char host[256]; // fits any dns name
+  time_t expires;
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+#ifdef __GLIBC__
+  // asynchronous lookup, referenced by libanl until completion
+  struct gaicb request;
+  struct addrinfo hints;
+#endif
+};
+typedef struct dd_coap_resolver_entry dd_coap_resolver_entry;
+
+static dd_coap_resolver_entry resolver_cache[DD_COAP_RESOLVER_CACHE_MAX];
+static dd_coap_resolver_stats resolver_stats;
+
+static void dd_coap_resolver_complete(dd_coap_resolver_entry *entry, int ret,
+                                      struct addrinfo *info, time_t now) {
+  assert(entry != 0);
 
-  int ret = getaddrinfo(host, 0, &hints, &info);
   if (ret != 0) {
     // no matter what went wrong, nothing to be done about it ...
-    fprintf(stderr, "getaddrinfo(%s) failed: %s\n", host, gai_strerror(ret));
+    fprintf(stderr, "getaddrinfo(%s) failed: %s\n", entry->host,
+            gai_strerror(ret));
+    entry->state = DD_RESOLVER_FAILED;
+    entry->expires = now + DD_COAP_RESOLVER_NEGATIVE_TTL;
+    return;
+  }
+
+  // prefer ipv6 like the server endpoint, else take the first ipv4 result
+  struct addrinfo *pick = 0;
+  for (struct addrinfo *i = info; i != 0; i = i->ai_next) {
+    if (i->ai_family == AF_INET6) {
+      pick = i;
+      break;
+    }
+    if (i->ai_family == AF_INET && pick == 0)
+      pick = i;
+  }
+  if (pick == 0) {
+    fprintf(stderr, "getaddrinfo(%s): no usable address\n", entry->host);
+    freeaddrinfo(info);
+    entry->state = DD_RESOLVER_FAILED;
+    entry->expires = now + DD_COAP_RESOLVER_NEGATIVE_TTL;
+    return;
+  }
+  memcpy(&entry->addr, pick->ai_addr, pick->ai_addrlen);
+  entry->addrlen = pick->ai_addrlen;
+  freeaddrinfo(info);
+  entry->state = DD_RESOLVER_VALID;
+  entry->expires = now + DD_COAP_RESOLVER_TTL;
+}
+
+static void dd_coap_resolver_start(dd_coap_resolver_entry *entry,
+                                   time_t now) {
+  assert(entry != 0);
+
+#ifdef __GLIBC__
+  // run lookup in libanl worker thread, poll for completion
+  bzero(&entry->request, sizeof(entry->request));
+  bzero(&entry->hints, sizeof(entry->hints));
+  entry->hints.ai_socktype = SOCK_DGRAM;
+  // only families with a configured local address, so the result is reachable
+  entry->hints.ai_family = AF_UNSPEC;
+  entry->hints.ai_flags = AI_ADDRCONFIG;
+  entry->request.ar_name = entry->host;
+  entry->request.ar_request = &entry->hints;
+  struct gaicb *list[] = {&entry->request};
+  struct sigevent sev = {.sigev_notify = SIGEV_NONE};
+
+  entry->state = DD_RESOLVER_PENDING;
+  int ret = getaddrinfo_a(GAI_NOWAIT, list, 1, &sev);
+  if (ret != 0) {
+    dd_coap_resolver_complete(entry, ret, 0, now);
+  }
+#else
+  // no asynchronous interface, resolve in place
+  struct addrinfo *info;
+  struct addrinfo hints = {.ai_socktype = SOCK_DGRAM,
+                           .ai_family = AF_UNSPEC,
+                           .ai_flags = AI_ADDRCONFIG};
+
+  int ret = getaddrinfo(entry->host, 0, &hints, &info);
+  dd_coap_resolver_complete(entry, ret, info, now);
+#endif
+}
+
+int dd_coap_resolve(coap_address_t *address, const char *host, uint16_t port) {
+  assert(address != 0);
+  assert(host != 0);
+  time_t now = time(0);
+  dd_coap_resolver_entry *entry = 0;
+
+  if (strlen(host) >= sizeof(resolver_cache[0].host)) {
+    // not a valid host name
     return -1;
   }
 
-  // blindly pick the first result
-  coap_address_init(address);
-  memcpy(&address->addr, info->ai_addr, info->ai_addrlen);
-  address->size = info->ai_addrlen;
-  coap_address_set_port(address, port);
+  // find cached entry, else the free or earliest expiring settled entry
+  for (size_t i = 0; i < DD_COAP_RESOLVER_CACHE_MAX; i++) {
+    dd_coap_resolver_entry *candidate = &resolver_cache[i];
+    if (candidate->state != DD_RESOLVER_FREE &&
+        strcmp(candidate->host, host) == 0) {
+      entry = candidate;
+      break;
+    }
+#ifdef __GLIBC__
+    if (candidate->state == DD_RESOLVER_PENDING) {
+      // settle lookups nobody polls anymore, e.g. of deleted bindings, so
+      // that their entries can be evicted
+      int ret = gai_error(&candidate->request);
+      if (ret != EAI_INPROGRESS)
+        dd_coap_resolver_complete(candidate, ret,
+                                  candidate->request.ar_result, now);
+    }
+#endif
+    if (candidate->state == DD_RESOLVER_PENDING)
+      continue;
+    if (entry == 0 || candidate->state == DD_RESOLVER_FREE ||
+        (entry->state != DD_RESOLVER_FREE &&
+         candidate->expires < entry->expires))
+      entry = candidate;
+  }
+  if (entry == 0) {
+    // all entries busy resolving, try again later
+    return 1;
+  }
 
-  freeaddrinfo(info);
-  return 0;
+  if (entry->state == DD_RESOLVER_PENDING) {
+#ifdef __GLIBC__
+    int ret = gai_error(&entry->request);
+    if (ret == EAI_INPROGRESS)
+      return 1;
+    dd_coap_resolver_complete(entry, ret, entry->request.ar_result, now);
+#endif
+  } else if (strcmp(entry->host, host) == 0 &&
+             difftime(entry->expires, now) > 0) {
+    // cached
+    if (entry->state == DD_RESOLVER_VALID)
+      resolver_stats.hits++;
+    else
+      resolver_stats.negative_hits++;
+  } else {
+    // not cached or expired
+    resolver_stats.misses++;
+    strcpy(entry->host, host);
+    dd_coap_resolver_start(entry, now);
+  }
+
+  switch (entry->state) {
+  case DD_RESOLVER_VALID:
+    coap_address_init(address);
+    memcpy(&address->addr, &entry->addr, entry->addrlen);
+    address->size = entry->addrlen;
+    coap_address_set_port(address, port);
+    return 0;
+  case DD_RESOLVER_PENDING:
+    return 1;
+  default:
+    return -1;
+  }
+}
+
+const dd_coap_resolver_stats *dd_coap_get_resolver_stats() {
+  return &resolver_stats;
 }
 #endif
+
+/*
+ * Client Session Pool
+ */
+struct dd_coap_pooled_session {
+  dd_scheme scheme;
+  char host[256]; // fits any dns name
+  uint16_t port;
+  coap_session_t *session; // 0: unused entry
+  time_t used;             // last handed out
+};
+typedef struct dd_coap_pooled_session dd_coap_pooled_session;
+
+static dd_coap_pooled_session pool[DD_COAP_SESSIONS_MAX];
+
+static void dd_coap_pool_release(dd_coap_pooled_session *entry) {
+  assert(entry != 0);
+
+  if (entry->session != 0) {
+    coap_session_release(entry->session);
+    entry->session = 0;
+  }
+}
+
+int dd_coap_session(coap_session_t **session, coap_context_t *context,
+                    dd_uri *uri, time_t now) {
+  assert(session != 0);
+  assert(context != 0);
+  assert(uri != 0);
+  dd_coap_pooled_session *entry = 0;
+  const char *host = dd_uri_host(uri);
+
+  if (strlen(host) >= sizeof(pool[0].host)) {
+    // not a valid host name
+    return -1;
+  }
+
+  // find existing session, else the unused or least recently used entry
+  for (size_t i = 0; i < DD_COAP_SESSIONS_MAX; i++) {
+    dd_coap_pooled_session *candidate = &pool[i];
+    if (candidate->session != 0 && candidate->scheme == uri->scheme &&
+        candidate->port == uri->port &&
+        strcmp(candidate->host, host) == 0) {
+      candidate->used = now;
+      *session = candidate->session;
+      return 0;
+    }
+
+    // otherwise pick an unused entry, else the least recently used one
+    if (entry == 0)
+      entry = candidate;
+    else if (entry->session != 0 &&
+             (candidate->session == 0 || candidate->used < entry->used))
+      entry = candidate;
+  }
+  assert(entry != 0);
+
+  // resolve destination, default port by scheme
+  uint16_t port = uri->port;
+  if (port == 0)
+    port = uri->scheme == DD_COAPS ? COAPS_DEFAULT_PORT : COAP_DEFAULT_PORT;
+  coap_address_t addr;
+  int ret = dd_coap_resolve(&addr, host, port);
+  if (ret != 0) {
+    // pending or failed
+    return ret;
+  }
+
+  // create session
+  dd_coap_pool_release(entry);
+  switch (uri->scheme) {
+  case DD_NONE: // scheme-less uri, plain coap
+  case DD_COAP:
+    *session = coap_new_client_session(context, 0, &addr, COAP_PROTO_UDP);
+    break;
+  case DD_COAPS: {
+    // HACK same DTLS key as server
+    uint8_t key = 'b'; // TODO: use proper key and identity
+    *session = coap_new_client_session_psk(context, 0, &addr, COAP_PROTO_DTLS,
+                                           "", &key, 1);
+    break;
+  }
+  default:
+    // unsupported scheme
+    return -1;
+  }
+  if (*session == 0) {
+    return -1;
+  }
+
+  // remember
+  entry->scheme = uri->scheme;
+  strcpy(entry->host, host);
+  entry->port = uri->port;
+  entry->session = *session;
+  entry->used = now;
+  return 0;
+}
+
+void dd_coap_session_failed(coap_session_t *session) {
+  assert(session != 0);
+
+  for (size_t i = 0; i < DD_COAP_SESSIONS_MAX; i++) {
+    if (pool[i].session == session) {
+      dd_coap_pool_release(&pool[i]);
+      return;
+    }
+  }
+}
+
+void dd_coap_sessions_expire(time_t now) {
+  for (size_t i = 0; i < DD_COAP_SESSIONS_MAX; i++) {
+    if (pool[i].session != 0 &&
+        difftime(now, pool[i].used) > DD_COAP_SESSION_IDLE_MAX) {
+      dd_coap_pool_release(&pool[i]);
+    }
+  }
+}
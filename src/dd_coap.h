@@ -6,6 +6,10 @@
 
 #include <coap2/coap.h>
 #include <stdint.h>
+#include <time.h>
+
+struct dd_uri;
+typedef struct dd_uri dd_uri;
 
 /*
  * CoAP Abstraction
@@ -13,6 +17,67 @@
 
 typedef struct coap_address_t coap_address_t;
 
+/*
+ * Caching Resolver
+ *
+ * Lookups run asynchronously (getaddrinfo_a, where available), results are
+ * cached for DD_COAP_RESOLVER_TTL seconds, failures for
+ * DD_COAP_RESOLVER_NEGATIVE_TTL seconds.
+ */
+#define DD_COAP_RESOLVER_CACHE_MAX 16
+#define DD_COAP_RESOLVER_TTL 300
+#define DD_COAP_RESOLVER_NEGATIVE_TTL 30
+
+struct dd_coap_resolver_stats {
+  uint32_t hits;          // answered from cache
+  uint32_t negative_hits; // failure answered from cache
+  uint32_t misses;        // lookups started
+};
+typedef struct dd_coap_resolver_stats dd_coap_resolver_stats;
+
+/*
+ * resolve host, poll again while lookup is in progress
+ *
+ * returns:
+ * - -1 on error
+ * -  0 on success, address set
+ * -  1 while lookup is in progress
+ */
 int dd_coap_resolve(coap_address_t *address, const char *host, uint16_t port);
 
+const dd_coap_resolver_stats *dd_coap_get_resolver_stats();
+
+/*
+ * Client Session Pool
+ *
+ * Sessions to binding destinations are kept across notifications, keyed by
+ * scheme, host and port. Sessions idle for longer than
+ * DD_COAP_SESSION_IDLE_MAX seconds are released.
+ */
+#define DD_COAP_SESSIONS_MAX 16
+#define DD_COAP_SESSION_IDLE_MAX 600
+
+/*
+ * get pooled client session for destination uri, create if necessary
+ *
+ * Note: the pool owns the session, do not release it.
+ *
+ * returns:
+ * - -1 on error
+ * -  0 on success, session set
+ * -  1 while destination is being resolved
+ */
+int dd_coap_session(coap_session_t **session, coap_context_t *context,
+                    dd_uri *uri, time_t now);
+
+/*
+ * release pooled session after it failed, e.g. on send error
+ */
+void dd_coap_session_failed(coap_session_t *session);
+
+/*
+ * release sessions idle since before now - DD_COAP_SESSION_IDLE_MAX
+ */
+void dd_coap_sessions_expire(time_t now);
+
 #endif /* HAVE_DDCOAP_H */
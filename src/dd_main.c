@@ -3,22 +3,73 @@
  * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
 #include <arpa/inet.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "dd_coap.h"
 #include "dd_main.h"
 #include "dd_resources.h"
+#include "dd_schedule.h"
 #include "dd_storage.h"
 #include "dd_types.h"
 
-static struct { coap_context_t *context; } state;
+static struct {
+  coap_context_t *context;
+  bool batch;
+} state;
+
+/*
+ * offset report deadlines within [min, max] reporting interval
+ */
+void dd_set_report_jitter(uint8_t percent, bool spread, uint32_t seed) {
+  dd_schedule_set_jitter(percent, spread, seed);
+}
+
+/*
+ * pack notifications for same destination into one message
+ */
+void dd_set_notification_batching(bool enabled) { state.batch = enabled; }
+
+/*
+ * set seconds between writing notification times to storage
+ */
+void dd_set_checkpoint_interval(uint32_t interval) {
+  dd_schedule_set_checkpoint_interval(interval);
+}
+
+/*
+ * write volatile state to storage, e.g. at shutdown
+ */
+void dd_checkpoint() { dd_schedule_checkpoint(time(0), true); }
+
+/*
+ * configure data file and table sizes
+ */
+void dd_set_storage(const char *path, uint8_t bindings,
+                    uint16_t bindings_rowsize, uint8_t reports,
+                    uint16_t reports_rowsize) {
+  dd_storage_configure(path, bindings, bindings_rowsize, reports,
+                       reports_rowsize);
+}
+
+/*
+ * sync journal per mutation, or per dd_process_incoming
+ */
+void dd_set_storage_sync(bool bindings, bool reports) {
+  dd_storage_set_durability(bindings ? DD_STORAGE_SYNC : DD_STORAGE_GROUP,
+                            reports ? DD_STORAGE_SYNC : DD_STORAGE_GROUP);
+}
 
 /*
  * Initialize dotdot internal state
  */
 void dd_init() {
-  // initialize persistent storage
-  dd_storage_init();
+  // initialize persistent storage, tables are unusable without
+  if (dd_storage_init() != 0) {
+    fprintf(stderr, "Failed to initialize storage!\n");
+    exit(EXIT_FAILURE);
+  }
   dd_storage_link(__device);
+  dd_schedule_init(__device);
 
   // initialize libcoap
   coap_startup();
@@ -30,6 +81,11 @@ void dd_init() {
   // create libcoap context
   state.context = coap_new_context(0);
 
+  // track delivery of confirmable notifications
+  coap_register_response_handler(state.context,
+                                 dd_handle_notification_response);
+  coap_register_nack_handler(state.context, dd_handle_notification_nack);
+
   // create default resource
   struct coap_resource_t *resource =
       coap_resource_unknown_init(dd_handle_root); // registers put
@@ -43,6 +99,29 @@ void dd_init() {
 
   // register resource
   coap_add_resource(state.context, resource);
+
+  // create observable resource for each attribute, also handled by root
+  for (size_t i = 0; i < __device->routes_length; i++) {
+    dd_route *route = &__device->routes[i];
+    if ((uint8_t)(route->key >> 16) != 'a')
+      continue;
+
+    char uri[32]; // zcl/e/ff/sffff/a/ffff
+    int length =
+        snprintf(uri, sizeof(uri), "zcl/e/%x/%c%x/a/%x", route->endpoint->id,
+                 route->cluster->role, route->cluster->id,
+                 route->attribute->id);
+    assert(length > 0 && length < sizeof(uri));
+
+    resource = coap_resource_init(coap_new_str_const((uint8_t *)uri, length),
+                                  COAP_RESOURCE_FLAGS_RELEASE_URI);
+    coap_register_handler(resource, COAP_REQUEST_GET, dd_handle_root);
+    coap_register_handler(resource, COAP_REQUEST_PUT, dd_handle_root);
+    coap_resource_set_get_observable(resource, 1);
+    coap_resource_set_userdata(resource, route);
+    coap_add_resource(state.context, resource);
+    route->attribute->resource = resource;
+  }
 }
 
 /*
@@ -137,15 +216,30 @@ void dd_start_secure() {
  * process (some) dotdot messages
  */
 int dd_process_incoming(uint32_t timeout) {
+  // Note: libcoap waits forever on 0
+  if (timeout == 0)
+    timeout = COAP_IO_NO_WAIT;
+
   int ret = coap_io_process(state.context, timeout);
   if (ret == -1) {
     fprintf(stderr, "encountered error in libcoap while processing IO ...!\n");
     return -1;
   }
 
+  // group commit mutations of requests processed above
+  if (dd_storage_commit() != 0) {
+    // not fatal, but mutations processed above are not durable
+    fprintf(stderr, "failed to commit storage journal!\n");
+  }
+
   return 0;
 }
 
 int32_t dd_process_outgoing() {
-  return dd_process_bindings(state.context, __device);
+  int32_t timeout = dd_process_bindings(state.context, __device, state.batch);
+  if (timeout < 0)
+    return -1;
+
+  // seconds to milliseconds, as taken by dd_process_incoming
+  return timeout * 1000;
 }
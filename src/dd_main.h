@@ -4,8 +4,62 @@
 #ifndef HAVE_DDSETUP_H
 #define HAVE_DDSETUP_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
+/*
+ * offset report deadlines by up to percent of the window between minimum and
+ * maximum reporting interval, so that nodes do not notify all at once, e.g.
+ * after power restore
+ *
+ * With spread, bindings divide the window evenly instead. Seed should be
+ * unique per device, e.g. derived from its EUI-64; 0 picks a random one.
+ *
+ * Note: call before dd_init. Jitter is disabled by default.
+ */
+void dd_set_report_jitter(uint8_t percent, bool spread, uint32_t seed);
+
+/*
+ * pack notifications due at the same time for the same destination uri into
+ * one message, as cbor array of notifications
+ *
+ * Note: receivers must support batched notifications. Disabled by default.
+ */
+void dd_set_notification_batching(bool enabled);
+
+/*
+ * set seconds between writing notification times to storage, default 3600
+ *
+ * Note: 0 writes after every notification. After a crash, bindings may
+ * notify once more than necessary.
+ */
+void dd_set_checkpoint_interval(uint32_t interval);
+
+/*
+ * write volatile state to storage, e.g. at shutdown
+ */
+void dd_checkpoint();
+
+/*
+ * configure path of data file, and capacity and row size of binding and
+ * report configuration tables; 0 or null keep defaults
+ *
+ * Note: call before dd_init. Tables grow on demand, capacity only limits them.
+ */
+void dd_set_storage(const char *path, uint8_t bindings,
+                    uint16_t bindings_rowsize, uint8_t reports,
+                    uint16_t reports_rowsize);
+
+/*
+ * make configuration changes of bindings and report configurations durable
+ * before responding; otherwise changes of one dd_process_incoming call share
+ * one sync, and may be lost in a crash after being acknowledged
+ *
+ * Note: default true for both. Notification times are always written with
+ * the next checkpoint.
+ */
+void dd_set_storage_sync(bool bindings, bool reports);
+
 /*
  * Initialize dotdot internal state
  */
@@ -22,7 +76,8 @@ void dd_start();
 void dd_start_secure();
 
 /*
- * spend up to timeout milliseconds processing incoming messages
+ * spend up to timeout milliseconds processing incoming messages, 0 only
+ * processes what is pending
  *
  * returns -1 on error
  */
@@ -31,7 +86,8 @@ int dd_process_incoming(uint32_t timeout);
 /*
  * process outgoing messages (bindings)
  *
- * returns time in seconds system may sleep; -1 on error
+ * returns time in milliseconds system may sleep, until the earliest minimum
+ * or maximum reporting interval of any binding; -1 on error
  */
 int32_t dd_process_outgoing();
 
@@ -1,75 +1,205 @@
 /* This Source Code Form is subject to the terms of the Mozilla Public
  * License, v. 2.0. If a copy of the MPL was not distributed with this
  * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
-#include <ctype.h>
 #include <stdio.h>
+#include <unistd.h>
 
 #include "dd_cbor.h"
 #include "dd_coap.h"
 #include "dd_resources.h"
+#include "dd_schedule.h"
 #include "dd_storage.h"
 #include "dd_types.h"
 
+// zcl status codes
+#define DD_ZCL_SUCCESS 0x00
+#define DD_ZCL_UNSUPPORTED_ATTRIBUTE 0x86
+#define DD_ZCL_INVALID_VALUE 0x87
+#define DD_ZCL_INVALID_DATA_TYPE 0x8d
+
 /*
- * strtoul helper
+ * parse hexadecimal number of given length in place
  *
  * returns:
- * -  ptr to next character after numeric expression on success
- * -  0 on error
+ * -  0 on success
+ * -  -1 on error
  */
-static const char *dd_strtoul(unsigned long int *destination,
-                              const char *source, int base,
-                              unsigned long int max) {
+static int dd_parse_hex(unsigned long int *destination, const uint8_t *source,
+                        size_t length, unsigned long int max) {
   assert(destination != 0 && source != 0);
-  char *end;
-
-  *destination = strtoul(source, &end, base);
-  if ((*destination == 0 && source[0] != '0') || end[0] != '\0' ||
-      max < *destination) {
-    // parsing failed, was incomplete or value out of range
-    return 0;
+  unsigned long int value = 0;
+
+  if (length == 0) {
+    // empty string is not a number
+    return -1;
+  }
+
+  for (size_t i = 0; i < length; i++) {
+    uint8_t digit;
+    if (source[i] >= '0' && source[i] <= '9')
+      digit = source[i] - '0';
+    else if (source[i] >= 'a' && source[i] <= 'f')
+      digit = source[i] - 'a' + 10;
+    else if (source[i] >= 'A' && source[i] <= 'F')
+      digit = source[i] - 'A' + 10;
+    else
+      return -1; // not a hexadecimal digit
+
+    value = value * 16 + digit;
+    if (value > max) {
+      // value out of range
+      return -1;
+    }
   }
 
-  return end;
+  *destination = value;
+  return 0;
 }
 
-/**
- * decode a percent-encoded C string with optional path normalization
+/*
+ * Request path /zcl/e/<eid>/<cl>/<sub>/<id> split into route key components
+ */
+struct dd_path {
+  size_t depth; // number of levels parsed
+  uint8_t eid;
+  char role;
+  uint16_t cid;
+  char sub;
+  uint16_t id;
+};
+typedef struct dd_path dd_path;
+
+/*
+ * parse next level of request path
  *
- * The buffer pointed to by @dst must be at least strlen(@src) bytes.
- * Decoding stops at the first character from @src that decodes to null.
+ * Note: level points into the request pdu and is not null-terminated!
  *
- * @param dst       destination buffer
- * @param src       source buffer
+ * returns:
+ * -  0 on success
+ * -  -1 if there is no such resource
+ */
+static int dd_parse_path_level(dd_path *path, const uint8_t *level,
+                               size_t length) {
+  assert(path != 0 && level != 0);
+  unsigned long int value, max;
+
+  switch (path->depth) {
+  case 0: // /zcl
+    //  only know about "zcl" at this time
+    if (length != 3 || memcmp("zcl", level, 3) != 0) {
+      printf("first level not \"zcl\"\n");
+      return -1;
+    }
+    break;
+  case 1: // /zcl/e
+    // TODO: other entrypoint resources
+    if (length != 1 || level[0] != 'e') {
+      return -1;
+    }
+    break;
+  case 2: // /zcl/e/<eid>
+    // endpoint identifiers are limited by 1 byte
+    if (dd_parse_hex(&value, level, length, UINT8_MAX) != 0) {
+      printf("invalid endpoint identifier \"%.*s\"\n", (int)length, level);
+      return -1;
+    }
+    path->eid = value;
+    break;
+  case 3: // /zcl/e/<eid>/<cl>
+    // first cluster role (c|s)
+    if (length < 1 || (level[0] != 'c' && level[0] != 's')) {
+      printf("invalid cluster role \"%.*s\"\n", (int)length, level);
+      return -1;
+    }
+    path->role = level[0];
+
+    // next cluster number, limited by 2 byte
+    if (dd_parse_hex(&value, level + 1, length - 1, UINT16_MAX) != 0) {
+      printf("invalid cluster number \"%.*s\"\n", (int)length - 1,
+             level + 1);
+      return -1;
+    }
+    path->cid = value;
+    break;
+  case 4: // /zcl/e/<eid>/<cl>/<sub>
+    // a(ttributes), b(indings), c(ommands), n(otifications) and r(eport
+    // configurations)
+    if (length != 1 || level[0] == '\0' || strchr("abcnr", level[0]) == 0) {
+      return -1;
+    }
+    path->sub = level[0];
+    break;
+  case 5: // /zcl/e/<eid>/<cl>/<sub>/<id>
+    switch (path->sub) {
+    case 'a': // attribute identifiers are limited by 2 byte
+    case 'c': // command identifiers are limited by 2 byte
+      max = UINT16_MAX;
+      break;
+    case 'b': // binding identifiers are limited by 1 byte
+    case 'r': // report identifiers are limited by 1 byte
+      max = UINT8_MAX;
+      break;
+    default:
+      // notification resource has no children
+      return -1;
+    }
+    if (dd_parse_hex(&value, level, length, max) != 0) {
+      printf("invalid identifier \"%.*s\"\n", (int)length, level);
+      return -1;
+    }
+    path->id = value;
+    break;
+  default:
+    // instance resources have no children
+    return -1;
+  }
+
+  path->depth++;
+  return 0;
+}
+
+/*
+ * build strong etag from boot nonce and a generation counter
+ *
+ * Note: counters restart at boot, the nonce keeps etags of earlier runs from
+ * matching.
+ */
+static void dd_make_etag(uint8_t etag[8], uint32_t generation) {
+  static uint32_t nonce = 0;
+  if (nonce == 0) {
+    nonce = (uint32_t)time(0) ^ ((uint32_t)getpid() << 16);
+  }
+
+  memcpy(etag, &nonce, sizeof(nonce));
+  memcpy(etag + sizeof(nonce), &generation, sizeof(generation));
+}
 
- * @return          number of valid characters in @dst
- * @author          Johan Lindh <johan@linkdata.se>
- * @legalese        BSD licensed (http://opensource.org/licenses/BSD-2-Clause)
+/*
+ * check whether request carries etag in any of its ETag options
  */
-static ptrdiff_t urldecode(char *dst, char *src) {
-  char *org_dst = dst;
-  char ch, a, b;
-  do {
-    ch = *src++;
-    if (ch == '%' && isxdigit(a = src[0]) && isxdigit(b = src[1])) {
-      if (a < 'A')
-        a -= '0';
-      else if (a < 'a')
-        a -= 'A' - 10;
-      else
-        a -= 'a' - 10;
-      if (b < 'A')
-        b -= '0';
-      else if (b < 'a')
-        b -= 'A' - 10;
-      else
-        b -= 'a' - 10;
-      ch = 16 * a + b;
-      src += 2;
+static bool dd_match_etag(coap_pdu_t *request, const uint8_t *etag,
+                          size_t etag_length) {
+  assert(etag != 0);
+  coap_opt_iterator_t opt_iter;
+  coap_opt_filter_t opt_filter;
+  coap_opt_t *option;
+
+  if (request == 0) {
+    // observe notification
+    return false;
+  }
+
+  coap_option_filter_clear(opt_filter);
+  coap_option_filter_set(opt_filter, COAP_OPTION_ETAG);
+  coap_option_iterator_init(request, &opt_iter, opt_filter);
+  while ((option = coap_option_next(&opt_iter)) != 0) {
+    if (coap_opt_length(option) == etag_length &&
+        memcmp(coap_opt_value(option), etag, etag_length) == 0) {
+      return true;
     }
-    *dst++ = ch;
-  } while (ch);
-  return (dst - org_dst) - 1;
+  }
+
+  return false;
 }
 
 /*
@@ -79,43 +209,107 @@ void dd_handle_root(coap_context_t *context, struct coap_resource_t *resource,
                     coap_session_t *session, coap_pdu_t *request,
                     coap_binary_t *token, coap_string_t *query,
                     coap_pdu_t *response) {
-  coap_string_t *path;
-  const char *level;
+  coap_opt_iterator_t opt_iter;
+  coap_opt_filter_t opt_filter;
+  coap_opt_t *option;
   dd_device *device = __device;
-  dd_endpoint *endpoint = 0;
-  dd_cluster *cluster = 0;
-  dd_attribute *attribute = 0;
+  dd_path path = {0};
+  dd_route *route = 0;
   dd_binding *binding = 0;
-  dd_command *command = 0;
   dd_report *report = 0;
 
-  // look-up request path
-  path = coap_get_uri_path(request);
-  assert(path !=
-         0); // code study shows this is always a valid coap_string_t instance
+  printf("invoked root handler\n");
 
-  // somehow uri path might be urlencoded :@
-  urldecode((char *)path->s, (char *)path->s);
+  if (request == 0) {
+    // observe notification, libcoap passes no request: the attribute
+    // resource carries its route
+    route = coap_resource_get_userdata(resource);
+    assert(route != 0);
+    dd_handle_attribute_get(device, route->endpoint, route->cluster,
+                            route->attribute, resource, session, request,
+                            token, query, response);
+    return;
+  }
 
-  printf("invoked root handler at \"%s\"\n", path->s);
-  goto uri;
+  // parse path into route key components, straight from Uri-Path options
+  coap_option_filter_clear(opt_filter);
+  coap_option_filter_set(opt_filter, COAP_OPTION_URI_PATH);
+  coap_option_iterator_init(request, &opt_iter, opt_filter);
+  while ((option = coap_option_next(&opt_iter)) != 0) {
+    if (coap_opt_length(option) == 0) {
+      // skip empty segments, e.g. trailing '/'
+      continue;
+    }
 
-uri: // /
-  // parse path - first level
-  level = strtok((char *)path->s, "/");
+    if (dd_parse_path_level(&path, coap_opt_value(option),
+                            coap_opt_length(option)) != 0) {
+      goto error_no_resource;
+    }
+  }
 
-  //  only know about "zcl" at this time
-  if (level == 0 || strcmp("zcl", level) != 0) {
-    printf("first level not \"zcl\"\n");
+  // resolve all resources along the path in a single look-up
+  assert(device != 0);
+  switch (path.depth) {
+  case 0: // /
     goto error_no_resource;
-  }
+  case 1: // /zcl
+  case 2: // /zcl/e
+    break;
+  case 3: // /zcl/e/<eid>
+    route = dd_find_route(device, DD_ROUTE_KEY(path.eid, 0, 0, 0, 0));
+    if (route == 0) {
+      // no such endpoint :(
+      goto error_no_resource;
+    }
+    break;
+  case 4: // /zcl/e/<eid>/<cl>
+  case 5: // /zcl/e/<eid>/<cl>/<sub>
+    route = dd_find_route(device,
+                          DD_ROUTE_KEY(path.eid, path.role, path.cid, 0, 0));
+    if (route == 0) {
+      // no such cluster :(
+      goto error_no_resource;
+    }
+    break;
+  case 6: // /zcl/e/<eid>/<cl>/<sub>/<id>
+    if (path.sub == 'a' || path.sub == 'c') {
+      // attributes and commands are part of the generated route table
+      route = dd_find_route(device, DD_ROUTE_KEY(path.eid, path.role, path.cid,
+                                                 path.sub, path.id));
+      if (route == 0) {
+        // no such attribute or command :(
+        goto error_no_resource;
+      }
+      break;
+    }
 
-  goto uri_zcl;
+    // bindings and report configurations are indexed per cluster
+    route = dd_find_route(device,
+                          DD_ROUTE_KEY(path.eid, path.role, path.cid, 0, 0));
+    if (route == 0) {
+      // no such cluster :(
+      goto error_no_resource;
+    }
+    if (path.sub == 'b') {
+      binding = dd_find_binding(route->cluster, path.id);
+      if (binding == 0) {
+        // no such binding :(
+        goto error_no_resource;
+      }
+    } else {
+      report = dd_find_report(route->cluster, path.id);
+      if (report == 0) {
+        // no such report :(
+        goto error_no_resource;
+      }
+    }
+    break;
+  default:
+    assert(0); // parser limits depth
+  }
 
-uri_zcl: // /zcl
-  // parse path - second level - zcl/
-  level = strtok(0, "/");
-  if (level == 0) {
+  switch (path.depth) {
+  case 1: // /zcl
     // Entrypoint Resources
     if (request->code == COAP_REQUEST_GET) {
       dd_handle_zcl_get(resource, session, request, token, query, response);
@@ -123,22 +317,7 @@ uri_zcl: // /zcl
     } else {
       goto error_no_resource;
     }
-  }
-
-  if (strcmp("e", level) == 0) {
-    goto uri_endpoint;
-  }
-
-  // TODO: other entrypoint resources
-  goto error_no_resource;
-
-uri_endpoint:          // /zcl/e
-  assert(device != 0); // parent resource must exist
-
-  // parse next level, if any
-  level = strtok(0, "/");
-
-  if (level == 0) {
+  case 2: // /zcl/e
     // Endpoint Collection
     if (request->code == COAP_REQUEST_GET) {
       dd_handle_endpoints_get(device, resource, session, request, token, query,
@@ -147,221 +326,14 @@ uri_endpoint:          // /zcl/e
     } else {
       goto error_no_resource;
     }
-  }
-
-  // expect Endpoint Identifier here
-  unsigned long int eid; // endpoint identifiers are limited by 1 byte
-  if (dd_strtoul(&eid, level, 16, UINT8_MAX) == 0) {
-    printf("invalid endpoint identifier \"%s\"\n", level);
-    goto error_no_resource;
-  }
-
-  // find this endpoint in resource tree
-  for (size_t i = 0; i < device->endpoints_length; i++) {
-    endpoint = device->endpoints[i];
-    if (endpoint->id == eid) {
-      goto uri_endpoint_eid;
-    }
-
-    // try next endpoint
-    continue;
-  }
-
-  // no such endpoint :(
-  goto error_no_resource;
-
-uri_endpoint_eid:        // /zcl/e/<eid>
-  assert(endpoint != 0); // parent resource must exist
-
-  // check path on this level
-  level = strtok(0, "/");
-
-  if (level == 0) {
+  case 3: // /zcl/e/<eid>
     // Endpoint Resource Collection
     switch (request->code) {
     case COAP_REQUEST_GET:
-      dd_handle_endpoint_get(device, endpoint, resource, session, request,
-                             token, query, response);
-      goto end_no_bias;
-    case COAP_REQUEST_POST:
-    case COAP_REQUEST_PUT:
-    case COAP_REQUEST_DELETE:
-      response->code = COAP_RESPONSE_CODE(405); // method not allowed
-      goto end_no_bias;
-    default:
-      assert(0); // other methods don't propagate here
-    }
-  }
-
-  // expect cluster identifier here
-  // first cluster role (c|s)
-  char role = level[0];
-  if (role != 'c' && role != 's') {
-    printf("invalid cluster role \"%s\"\n", level);
-    goto error_no_resource;
-  }
-
-  // Note: '\0' would have been caught as invalid role in previous step -->
-  // strlen(level) >= 1 next cluster number
-  unsigned long int cl; // cluster numbers are limited by 2 byte
-  if (dd_strtoul(&cl, &level[1], 16, UINT16_MAX) == 0) {
-    printf("invalid cluster number \"%s\"\n", &level[1]);
-    goto error_no_resource;
-  }
-
-  // find this cluster in resource tree
-  for (size_t i = 0; i < endpoint->cluster_length; i++) {
-    cluster = endpoint->cluster[i];
-    if (cluster->id == cl && cluster->role == role) {
-      goto uri_endpoint_eid_cl;
-    }
-
-    // try next cluster
-    continue;
-  }
-
-  // no such cluster :(
-  goto error_no_resource;
-
-uri_endpoint_eid_cl:    // /zcl/e/<eid>/<cl>
-  assert(cluster != 0); // parent resource must exist
-
-  // check path on this level
-  level = strtok(0, "/");
-
-  if (level == 0) {
-    // Cluster Resource Collection
-    switch (request->code) {
-    case COAP_REQUEST_GET:
-      dd_handle_cluster_get(device, endpoint, cluster, resource, session,
-                            request, token, query, response);
-      goto end_no_bias;
-    case COAP_REQUEST_POST:
-    case COAP_REQUEST_PUT:
-    case COAP_REQUEST_DELETE:
-      response->code = COAP_RESPONSE_CODE(405); // method not allowed
-      goto end_no_bias;
-    default:
-      assert(0); // other methods don't propagate here
-    }
-  }
-
-  if (strcmp("a", level) == 0) {
-    goto uri_endpoint_eid_cl_attribute;
-  }
-
-  if (strcmp("b", level) == 0) {
-    goto uri_endpoint_eid_cl_binding;
-  }
-
-  if (strcmp("c", level) == 0) {
-    goto uri_endpoint_eid_cl_command;
-  }
-
-  if (strcmp("n", level) == 0) {
-    goto uri_endpoint_eid_cl_notification;
-  }
-
-  if (strcmp("r", level) == 0) {
-    goto uri_endpoint_eid_cl_reports;
-  }
-
-  // this resource has no further children
-  goto error_no_resource;
-
-uri_endpoint_eid_cl_attribute: // /zcl/e/<eid>/<cl>/a
-  assert(cluster != 0);        // parent resource must exist
-
-  // check path on this level
-  level = strtok(0, "/");
-
-  if (level == 0) {
-    // Attribute Collection
-    switch (request->code) {
-    case COAP_REQUEST_GET:
-      dd_handle_attributes_get(device, endpoint, cluster, resource, session,
-                               request, token, query, response);
-      goto end_no_bias;
-    case COAP_REQUEST_POST:
-      dd_handle_attributes_post(device, endpoint, cluster, resource, session,
-                                request, token, query, response);
-      goto end_no_bias;
-    case COAP_REQUEST_PUT:
-    case COAP_REQUEST_DELETE:
-      response->code = COAP_RESPONSE_CODE(405); // method not allowed
-      goto end_no_bias;
-    default:
-      assert(0); // other methods don't propagate here
-    }
-  }
-
-  // expect attribute identifier here
-  unsigned long int aid; // attribute identifiers are limited by 2 byte
-  if (dd_strtoul(&aid, level, 16, UINT16_MAX) == 0) {
-    printf("invalid attribute identifier \"%s\"\n", level);
-    goto error_no_resource;
-  }
-
-  // find this attribute in resource tree
-  for (size_t i = 0; i < cluster->attributes_length; i++) {
-    attribute = cluster->attributes[i];
-    if (attribute->id == aid) {
-      goto uri_endpoint_eid_cl_attribute_aid;
-    }
-
-    // try next attribute
-    continue;
-  }
-
-  // no such attribute :(
-  goto error_no_resource;
-
-uri_endpoint_eid_cl_attribute_aid: // /zcl/e/<eid>/<cl>/a/<aid>
-  assert(attribute != 0);          // parent resource must exist
-
-  // check path on this level
-  level = strtok(0, "/");
-
-  if (level == 0) {
-    // Attribute Instance
-    switch (request->code) {
-    case COAP_REQUEST_GET:
-      dd_handle_attribute_get(device, endpoint, cluster, attribute, resource,
-                              session, request, token, query, response);
-      goto end_no_bias;
-    case COAP_REQUEST_PUT:
-      dd_handle_attribute_put(device, endpoint, cluster, attribute, resource,
-                              session, request, token, query, response);
-      goto end_no_bias;
-    case COAP_REQUEST_POST:
-    case COAP_REQUEST_DELETE:
-      response->code = COAP_RESPONSE_CODE(405); // method not allowed
-      goto end_no_bias;
-    default:
-      assert(0); // other methods don't propagate here
-    }
-  }
-
-  // this resource has no children
-  goto error_no_resource;
-
-uri_endpoint_eid_cl_binding: // /zcl/e/<eid>/<cl>/b
-  assert(cluster != 0);      // parent resource must exist
-
-  // check path on this level
-  level = strtok(0, "/");
-
-  if (level == 0) {
-    // Binding Collection
-    switch (request->code) {
-    case COAP_REQUEST_GET:
-      dd_handle_bindings_get(device, endpoint, cluster, resource, session,
+      dd_handle_endpoint_get(device, route->endpoint, resource, session,
                              request, token, query, response);
       goto end_no_bias;
     case COAP_REQUEST_POST:
-      dd_handle_bindings_post(device, endpoint, cluster, resource, session,
-                              request, token, query, response);
-      goto end_no_bias;
     case COAP_REQUEST_PUT:
     case COAP_REQUEST_DELETE:
       response->code = COAP_RESPONSE_CODE(405); // method not allowed
@@ -369,74 +341,13 @@ uri_endpoint_eid_cl_binding: // /zcl/e/<eid>/<cl>/b
     default:
       assert(0); // other methods don't propagate here
     }
-  }
-
-  // expect binding identifier
-  unsigned long int bid; // binding identifiers are limited by 1 byte
-  if (dd_strtoul(&bid, level, 16, UINT8_MAX) == 0) {
-    printf("invalid binding identifier \"%s\"\n", level);
-    goto error_no_resource;
-  }
-
-  // find this binding in resource tree
-  for (size_t i = 0; i < cluster->bindings_length; i++) {
-    binding = cluster->bindings[i];
-    if (binding->id == bid) {
-      goto uri_endpoint_eid_cl_binding_bid;
-    }
-
-    // try next binding
-    continue;
-  }
-
-  // no such binding :(
-  goto error_no_resource;
-
-uri_endpoint_eid_cl_binding_bid: // /zcl/e/<eid>/<cl>/b/<bid>
-  assert(binding != 0);          // parent resource must exist
-
-  // check path on this level
-  level = strtok(0, "/");
-
-  if (level == 0) {
-    // Binding Instance
+  case 4: // /zcl/e/<eid>/<cl>
+    // Cluster Resource Collection
     switch (request->code) {
     case COAP_REQUEST_GET:
-      dd_handle_binding_get(device, endpoint, cluster, binding, resource,
-                            session, request, token, query, response);
-      goto end_no_bias;
-    case COAP_REQUEST_PUT:
-      dd_handle_binding_put(device, endpoint, cluster, binding, resource,
+      dd_handle_cluster_get(device, route->endpoint, route->cluster, resource,
                             session, request, token, query, response);
       goto end_no_bias;
-    case COAP_REQUEST_DELETE:
-      dd_handle_binding_delete(device, endpoint, cluster, binding, resource,
-                               session, request, token, query, response);
-      goto end_no_bias;
-    case COAP_REQUEST_POST:
-      response->code = COAP_RESPONSE_CODE(405); // method not allowed
-      goto end_no_bias;
-    default:
-      assert(0); // other methods don't propagate here
-    }
-  }
-
-  // this resource has no children
-  goto error_no_resource;
-
-uri_endpoint_eid_cl_command: // /zcl/e/<eid>/<cl>/c
-  assert(cluster != 0);      // parent resource must exist
-
-  // check path on this level
-  level = strtok(0, "/");
-
-  if (level == 0) {
-    // Command Collection
-    switch (request->code) {
-    case COAP_REQUEST_GET:
-      dd_handle_commands_get(device, endpoint, cluster, resource, session,
-                             request, token, query, response);
-      goto end_no_bias;
     case COAP_REQUEST_POST:
     case COAP_REQUEST_PUT:
     case COAP_REQUEST_DELETE:
@@ -445,160 +356,196 @@ uri_endpoint_eid_cl_command: // /zcl/e/<eid>/<cl>/c
     default:
       assert(0); // other methods don't propagate here
     }
-  }
-
-  // expect command identifier here
-  unsigned long int cid; // command identifiers are limited by 2 byte
-  if (dd_strtoul(&cid, level, 16, UINT16_MAX) == 0) {
-    printf("invalid command identifier \"%s\"\n", level);
-    goto error_no_resource;
-  }
-
-  // find this command in resource tree
-  for (size_t i = 0; i < cluster->commands_length; i++) {
-    command = cluster->commands[i];
-    if (command->id == cid) {
-      goto uri_endpoint_eid_cl_command_cid;
-    }
-
-    // try next command
-    continue;
-  }
-
-  // no such command :(
-  goto error_no_resource;
-
-uri_endpoint_eid_cl_command_cid: // /zcl/e/<eid>/<cl>/c/<cid>
-  assert(command != 0);          // parent resource must exist
-
-  // check path on this level
-  level = strtok(0, "/");
-
-  if (level == 0) {
-    // Command Instance
-    switch (request->code) {
-    case COAP_REQUEST_POST:
-      dd_handle_command_post(device, endpoint, cluster, command, resource,
-                             session, request, token, query, response);
-      goto end_no_bias;
-    case COAP_REQUEST_GET:
-    case COAP_REQUEST_PUT:
-    case COAP_REQUEST_DELETE:
-      response->code = COAP_RESPONSE_CODE(405); // method not allowed
-      goto end_no_bias;
-    default:
-      assert(0); // other methods don't propagate here
-    }
-  }
-
-  // this resource has no children
-  goto error_no_resource;
-
-uri_endpoint_eid_cl_notification:
-  assert(cluster != 0); // parent resource must exist
-
-  // check path on this level
-  level = strtok(0, "/");
-
-  if (level == 0) {
-    // Notification Endpoint
-    switch (request->code) {
-    case COAP_REQUEST_POST:
-      dd_handle_notification_post(device, endpoint, cluster, resource, session,
-                                  request, token, query, response);
-      goto end_no_bias;
-    case COAP_REQUEST_GET:
-    case COAP_REQUEST_PUT:
-    case COAP_REQUEST_DELETE:
-      response->code = COAP_RESPONSE_CODE(405); // method not allowed
-      goto end_no_bias;
-    default:
-      assert(0); // other methods don't propagate here
-    }
-  }
-
-  // this resource has no children
-  goto error_no_resource;
-
-uri_endpoint_eid_cl_reports: // /zcl/e/<eid>/<cl>/r
-  assert(cluster != 0);      // parent resource must exist
-
-  // check path on this level
-  level = strtok(0, "/");
-
-  if (level == 0) {
-    // Report Configuration Collection
-    switch (request->code) {
-    case COAP_REQUEST_GET:
-      dd_handle_reports_get(device, endpoint, cluster, resource, session,
-                            request, token, query, response);
-      goto end_no_bias;
-    case COAP_REQUEST_POST:
-      dd_handle_reports_post(device, endpoint, cluster, resource, session,
-                             request, token, query, response);
-      goto end_no_bias;
-    case COAP_REQUEST_DELETE:
-    case COAP_REQUEST_PUT:
-      response->code = COAP_RESPONSE_CODE(405); // method not allowed
-      goto end_no_bias;
+  case 5: // /zcl/e/<eid>/<cl>/<sub>
+    switch (path.sub) {
+    case 'a': // /zcl/e/<eid>/<cl>/a
+      // Attribute Collection
+      switch (request->code) {
+      case COAP_REQUEST_GET:
+        dd_handle_attributes_get(device, route->endpoint, route->cluster,
+                                 resource, session, request, token, query,
+                                 response);
+        goto end_no_bias;
+      case COAP_REQUEST_POST:
+        dd_handle_attributes_post(device, route->endpoint, route->cluster,
+                                  resource, session, request, token, query,
+                                  response);
+        goto end_no_bias;
+      case COAP_REQUEST_PUT:
+      case COAP_REQUEST_DELETE:
+        response->code = COAP_RESPONSE_CODE(405); // method not allowed
+        goto end_no_bias;
+      default:
+        assert(0); // other methods don't propagate here
+      }
+    case 'b': // /zcl/e/<eid>/<cl>/b
+      // Binding Collection
+      switch (request->code) {
+      case COAP_REQUEST_GET:
+        dd_handle_bindings_get(device, route->endpoint, route->cluster,
+                               resource, session, request, token, query,
+                               response);
+        goto end_no_bias;
+      case COAP_REQUEST_POST:
+        dd_handle_bindings_post(device, route->endpoint, route->cluster,
+                                resource, session, request, token, query,
+                                response);
+        goto end_no_bias;
+      case COAP_REQUEST_PUT:
+      case COAP_REQUEST_DELETE:
+        response->code = COAP_RESPONSE_CODE(405); // method not allowed
+        goto end_no_bias;
+      default:
+        assert(0); // other methods don't propagate here
+      }
+    case 'c': // /zcl/e/<eid>/<cl>/c
+      // Command Collection
+      switch (request->code) {
+      case COAP_REQUEST_GET:
+        dd_handle_commands_get(device, route->endpoint, route->cluster,
+                               resource, session, request, token, query,
+                               response);
+        goto end_no_bias;
+      case COAP_REQUEST_POST:
+      case COAP_REQUEST_PUT:
+      case COAP_REQUEST_DELETE:
+        response->code = COAP_RESPONSE_CODE(405); // method not allowed
+        goto end_no_bias;
+      default:
+        assert(0); // other methods don't propagate here
+      }
+    case 'n': // /zcl/e/<eid>/<cl>/n
+      // Notification Endpoint
+      switch (request->code) {
+      case COAP_REQUEST_POST:
+        dd_handle_notification_post(device, route->endpoint, route->cluster,
+                                    resource, session, request, token, query,
+                                    response);
+        goto end_no_bias;
+      case COAP_REQUEST_GET:
+      case COAP_REQUEST_PUT:
+      case COAP_REQUEST_DELETE:
+        response->code = COAP_RESPONSE_CODE(405); // method not allowed
+        goto end_no_bias;
+      default:
+        assert(0); // other methods don't propagate here
+      }
+    case 'r': // /zcl/e/<eid>/<cl>/r
+      // Report Configuration Collection
+      switch (request->code) {
+      case COAP_REQUEST_GET:
+        dd_handle_reports_get(device, route->endpoint, route->cluster,
+                              resource, session, request, token, query,
+                              response);
+        goto end_no_bias;
+      case COAP_REQUEST_POST:
+        dd_handle_reports_post(device, route->endpoint, route->cluster,
+                               resource, session, request, token, query,
+                               response);
+        goto end_no_bias;
+      case COAP_REQUEST_DELETE:
+      case COAP_REQUEST_PUT:
+        response->code = COAP_RESPONSE_CODE(405); // method not allowed
+        goto end_no_bias;
+      default:
+        assert(0); // other methods don't propagate here
+      }
     default:
-      assert(0); // other methods don't propagate here
+      assert(0); // parser limits sub-resources
     }
-  }
-
-  // expect report identifier here
-  unsigned long int rid; // report identifiers are limited by 1 byte
-  if (dd_strtoul(&rid, level, 16, UINT8_MAX) == 0) {
-    printf("invalid report identifier \"%s\"\n", level);
-    goto error_no_resource;
-  }
-
-  // find this report configuration in resource tree
-  for (size_t i = 0; i < cluster->reports_length; i++) {
-    report = cluster->reports[i];
-    if (report->id == rid) {
-      goto uri_endpoint_eid_cl_report_rid;
-    }
-
-    // try next report
-    continue;
-  }
-
-  // no such report :(
-  goto error_no_resource;
-
-uri_endpoint_eid_cl_report_rid:
-  assert(report != 0); // parent resource must exist
-
-  // check path on this level
-  level = strtok(0, "/");
-
-  if (level == 0) {
-    // Attribute Instance
-    switch (request->code) {
-    case COAP_REQUEST_GET:
-      dd_handle_report_get(device, endpoint, cluster, report, resource, session,
-                           request, token, query, response);
-      goto end_no_bias;
-    case COAP_REQUEST_PUT:
-      dd_handle_report_put(device, endpoint, cluster, report, resource, session,
-                           request, token, query, response);
-      goto end_no_bias;
-    case COAP_REQUEST_DELETE:
-      dd_handle_report_delete(device, endpoint, cluster, report, resource,
-                              session, request, token, query, response);
-      goto end_no_bias;
-    case COAP_REQUEST_POST:
-      response->code = COAP_RESPONSE_CODE(405); // method not allowed
-      goto end_no_bias;
+  case 6: // /zcl/e/<eid>/<cl>/<sub>/<id>
+    switch (path.sub) {
+    case 'a': // /zcl/e/<eid>/<cl>/a/<aid>
+      // Attribute Instance
+      switch (request->code) {
+      case COAP_REQUEST_GET:
+        dd_handle_attribute_get(device, route->endpoint, route->cluster,
+                                route->attribute, resource, session, request,
+                                token, query, response);
+        goto end_no_bias;
+      case COAP_REQUEST_PUT:
+        dd_handle_attribute_put(device, route->endpoint, route->cluster,
+                                route->attribute, resource, session, request,
+                                token, query, response);
+        goto end_no_bias;
+      case COAP_REQUEST_POST:
+      case COAP_REQUEST_DELETE:
+        response->code = COAP_RESPONSE_CODE(405); // method not allowed
+        goto end_no_bias;
+      default:
+        assert(0); // other methods don't propagate here
+      }
+    case 'b': // /zcl/e/<eid>/<cl>/b/<bid>
+      // Binding Instance
+      switch (request->code) {
+      case COAP_REQUEST_GET:
+        dd_handle_binding_get(device, route->endpoint, route->cluster, binding,
+                              resource, session, request, token, query,
+                              response);
+        goto end_no_bias;
+      case COAP_REQUEST_PUT:
+        dd_handle_binding_put(device, route->endpoint, route->cluster, binding,
+                              resource, session, request, token, query,
+                              response);
+        goto end_no_bias;
+      case COAP_REQUEST_DELETE:
+        dd_handle_binding_delete(device, route->endpoint, route->cluster,
+                                 binding, resource, session, request, token,
+                                 query, response);
+        goto end_no_bias;
+      case COAP_REQUEST_POST:
+        response->code = COAP_RESPONSE_CODE(405); // method not allowed
+        goto end_no_bias;
+      default:
+        assert(0); // other methods don't propagate here
+      }
+    case 'c': // /zcl/e/<eid>/<cl>/c/<cid>
+      // Command Instance
+      switch (request->code) {
+      case COAP_REQUEST_POST:
+        dd_handle_command_post(device, route->endpoint, route->cluster,
+                               route->command, resource, session, request,
+                               token, query, response);
+        goto end_no_bias;
+      case COAP_REQUEST_GET:
+      case COAP_REQUEST_PUT:
+      case COAP_REQUEST_DELETE:
+        response->code = COAP_RESPONSE_CODE(405); // method not allowed
+        goto end_no_bias;
+      default:
+        assert(0); // other methods don't propagate here
+      }
+    case 'r': // /zcl/e/<eid>/<cl>/r/<rid>
+      // Report Configuration Instance
+      switch (request->code) {
+      case COAP_REQUEST_GET:
+        dd_handle_report_get(device, route->endpoint, route->cluster, report,
+                             resource, session, request, token, query,
+                             response);
+        goto end_no_bias;
+      case COAP_REQUEST_PUT:
+        dd_handle_report_put(device, route->endpoint, route->cluster, report,
+                             resource, session, request, token, query,
+                             response);
+        goto end_no_bias;
+      case COAP_REQUEST_DELETE:
+        dd_handle_report_delete(device, route->endpoint, route->cluster,
+                                report, resource, session, request, token,
+                                query, response);
+        goto end_no_bias;
+      case COAP_REQUEST_POST:
+        response->code = COAP_RESPONSE_CODE(405); // method not allowed
+        goto end_no_bias;
+      default:
+        assert(0); // other methods don't propagate here
+      }
     default:
-      assert(0); // other methods don't propagate here
+      assert(0); // parser limits sub-resources
     }
+  default:
+    assert(0); // parser limits depth
   }
 
-  // this resource has no children
-  goto error_no_resource;
-
 error_no_resource:
   // failure case when requested resource doesn't exist
   // return codes as per ZCL-IP spec section 2.8.6.1.1 table 12
@@ -633,25 +580,14 @@ void dd_handle_zcl_get(struct coap_resource_t *resource,
                        coap_session_t *session, coap_pdu_t *request,
                        coap_binary_t *token, coap_string_t *query,
                        coap_pdu_t *response) {
-  QCBOREncodeContext cec;
-  UsefulBuf_MAKE_STACK_UB(
-      response_buffer,
-      7); // pre-calculated space for entry-point resources ["e","g","t"]
-  UsefulBufC response_result = NULLUsefulBufC;
-
-  QCBOREncode_Init(&cec, response_buffer);
-  QCBOREncode_OpenArray(&cec);
-  QCBOREncode_AddSZString(&cec, "e");
-  // QCBOREncode_AddSZString(&cec, "g"); // TODO: implement
-  // QCBOREncode_AddSZString(&cec, "t"); // TODO: implement
-  QCBOREncode_CloseArray(&cec);
-  QCBORError ceerr = QCBOREncode_Finish(&cec, &response_result);
-  assert(ceerr == QCBOR_SUCCESS);
+  // pre-encoded entry-point resources ["e"]
+  // TODO: implement "g" and "t"
+  static const uint8_t zcl_cbor[] = {0x81, 0x61, 'e'};
 
   response->code = COAP_RESPONSE_CODE(205);
   coap_add_data_blocked_response(resource, session, request, response, token,
                                  COAP_MEDIATYPE_APPLICATION_CBOR, -1,
-                                 response_result.len, response_result.ptr);
+                                 sizeof(zcl_cbor), zcl_cbor);
 }
 
 // GET /zcl/e
@@ -661,26 +597,14 @@ void dd_handle_endpoints_get(dd_device *device,
                              coap_binary_t *token, coap_string_t *query,
                              coap_pdu_t *response) {
   assert(device != 0);
-  QCBOREncodeContext cec;
-  UsefulBuf_MAKE_STACK_UB(
-      response_buffer,
-      2 * 256 + 1); // endpoint ids uint8 (0..255) - each max 2 byte
-  UsefulBufC response_result = NULLUsefulBufC;
-
-  // encode endpoint identifiers as cbor array
-  QCBOREncode_Init(&cec, response_buffer);
-  QCBOREncode_OpenArray(&cec);
-  for (size_t i = 0; i < device->endpoints_length; i++)
-    QCBOREncode_AddUInt64(&cec, device->endpoints[i]->id);
-  QCBOREncode_CloseArray(&cec);
-  QCBORError ceerr = QCBOREncode_Finish(&cec, &response_result);
-  assert(ceerr == QCBOR_SUCCESS);
 
   // respond with 205 Content, media type application/cbor
+  // endpoint identifiers were encoded as cbor array by codegen
   response->code = COAP_RESPONSE_CODE(205);
   coap_add_data_blocked_response(resource, session, request, response, token,
                                  COAP_MEDIATYPE_APPLICATION_CBOR, -1,
-                                 response_result.len, response_result.ptr);
+                                 device->endpoints_cbor_length,
+                                 device->endpoints_cbor);
 }
 
 // GET /zcl/e/<eid>
@@ -691,33 +615,14 @@ void dd_handle_endpoint_get(dd_device *device, dd_endpoint *endpoint,
                             coap_pdu_t *response) {
   assert(device != 0);
   assert(endpoint != 0);
-  QCBOREncodeContext cec;
-  UsefulBuf_MAKE_STACK_UB(response_buffer,
-                          1024); // TODO: estimate meaningful size
-  UsefulBufC response_result = NULLUsefulBufC;
-
-  // encode cluster identifiers as cbor array
-  QCBOREncode_Init(&cec, response_buffer);
-  QCBOREncode_OpenArray(&cec);
-  for (int i = 0; i < endpoint->cluster_length; i++) {
-    char buf[1 + 4 + 1 + 4 + 1]; // 'c|s' + YYYY + '_' + ZZZZ + '\0'
-    int offset = snprintf(buf, sizeof(buf), "%c%x", endpoint->cluster[i]->role,
-                          endpoint->cluster[i]->id);
-    if (endpoint->cluster[i]->manufacturer != 0) {
-      snprintf(buf + offset, sizeof(buf) - offset, "_%x",
-               endpoint->cluster[i]->manufacturer);
-    }
-    QCBOREncode_AddSZString(&cec, buf);
-  }
-  QCBOREncode_CloseArray(&cec);
-  QCBORError ceerr = QCBOREncode_Finish(&cec, &response_result);
-  assert(ceerr == QCBOR_SUCCESS);
 
   // respond with 205 Content, media type application/cbor
+  // cluster identifiers were encoded as cbor array by codegen
   response->code = COAP_RESPONSE_CODE(205);
   coap_add_data_blocked_response(resource, session, request, response, token,
                                  COAP_MEDIATYPE_APPLICATION_CBOR, -1,
-                                 response_result.len, response_result.ptr);
+                                 endpoint->cluster_cbor_length,
+                                 endpoint->cluster_cbor);
 }
 
 // GET /zcl/e/<eid>/<cl>
@@ -730,30 +635,36 @@ void dd_handle_cluster_get(dd_device *device, dd_endpoint *endpoint,
   assert(device != 0);
   assert(endpoint != 0);
   assert(cluster != 0);
-  QCBOREncodeContext cec;
-  UsefulBuf_MAKE_STACK_UB(response_buffer,
-                          11); // pre-calculated space for entry-point resources
-                               // ["a","b","c","n","r"]
-  UsefulBufC response_result = NULLUsefulBufC;
-
-  // encode cluster resources as cbor array: a(ttributes), c(ommands),
-  // b(indings), r(eport configurations) and n(otifications)
-  QCBOREncode_Init(&cec, response_buffer);
-  QCBOREncode_OpenArray(&cec);
-  QCBOREncode_AddSZString(&cec, "a");
-  QCBOREncode_AddSZString(&cec, "b");
-  QCBOREncode_AddSZString(&cec, "c");
-  QCBOREncode_AddSZString(&cec, "n");
-  QCBOREncode_AddSZString(&cec, "r");
-  QCBOREncode_CloseArray(&cec);
-  QCBORError ceerr = QCBOREncode_Finish(&cec, &response_result);
-  assert(ceerr == QCBOR_SUCCESS);
+  // pre-encoded cluster resources: a(ttributes), b(indings), c(ommands),
+  // n(otifications) and r(eport configurations) ["a","b","c","n","r"]
+  static const uint8_t cluster_cbor[] = {0x85, 0x61, 'a', 0x61, 'b', 0x61,
+                                         'c',  0x61, 'n', 0x61, 'r'};
 
   // respond with 205 Content, media type application/cbor
   response->code = COAP_RESPONSE_CODE(205);
   coap_add_data_blocked_response(resource, session, request, response, token,
                                  COAP_MEDIATYPE_APPLICATION_CBOR, -1,
-                                 response_result.len, response_result.ptr);
+                                 sizeof(cluster_cbor), cluster_cbor);
+}
+
+/*
+ * find index of first attribute with id >= aid
+ *
+ * Note: codegen sorts attributes by id
+ */
+static size_t dd_attributes_lower_bound(dd_cluster *cluster, uint16_t aid) {
+  assert(cluster != 0);
+  size_t lower = 0, upper = cluster->attributes_length;
+
+  while (lower < upper) {
+    size_t middle = lower + (upper - lower) / 2;
+    if (cluster->attributes[middle]->id < aid)
+      lower = middle + 1;
+    else
+      upper = middle;
+  }
+
+  return lower;
 }
 
 // GET /zcl/e/<eid>/<cl>/a
@@ -770,6 +681,10 @@ void dd_handle_attributes_get(dd_device *device, dd_endpoint *endpoint,
   UsefulBuf_MAKE_STACK_UB(response_buffer,
                           1024); // TODO: use meaningful estimate
   UsefulBufC response_result = NULLUsefulBufC;
+  // bitmap of attributes (by index) selected by filter
+  uint8_t selected[cluster->attributes_length / 8 + 1];
+  bool filtered = false;
+  bzero(selected, sizeof(selected));
 
   // evaluate query, if any
   if (query != 0 && query->length > 0) {
@@ -805,9 +720,11 @@ void dd_handle_attributes_get(dd_device *device, dd_endpoint *endpoint,
           // unexpected state, parsing failed
           i = query->length;
           state = 255;
+          break;
         }
 
-        printf("filter item: *\n");
+        // select all attributes
+        memset(selected, 0xff, sizeof(selected));
         state = 0;
         break;
       }
@@ -868,7 +785,12 @@ void dd_handle_attributes_get(dd_device *device, dd_endpoint *endpoint,
             break;
           }
 
-          printf("filter item: %lx\n", aid);
+          // select attribute, if supported
+          size_t index = dd_attributes_lower_bound(cluster, aid);
+          if (index < cluster->attributes_length &&
+              cluster->attributes[index]->id == aid) {
+            selected[index / 8] |= 1 << (index % 8);
+          }
           state = 0;
           break;
         }
@@ -896,7 +818,12 @@ void dd_handle_attributes_get(dd_device *device, dd_endpoint *endpoint,
             break;
           }
 
-          printf("filter item: %lx + %lx\n", start, count);
+          // select up to count supported attributes, starting at start
+          for (size_t index = dd_attributes_lower_bound(cluster, start);
+               index < cluster->attributes_length && count > 0;
+               index++, count--) {
+            selected[index / 8] |= 1 << (index % 8);
+          }
           state = 0;
           break;
         }
@@ -923,7 +850,13 @@ void dd_handle_attributes_get(dd_device *device, dd_endpoint *endpoint,
             break;
           }
 
-          printf("filter item: %lx - %lx\n", start, end);
+          // select supported attributes in range start..end (inclusive)
+          for (size_t index = dd_attributes_lower_bound(cluster, start);
+               index < cluster->attributes_length &&
+               cluster->attributes[index]->id <= end;
+               index++) {
+            selected[index / 8] |= 1 << (index % 8);
+          }
           state = 0;
           break;
         }
@@ -949,35 +882,49 @@ void dd_handle_attributes_get(dd_device *device, dd_endpoint *endpoint,
       printf("parsing query failed!\n");
       goto error;
     }
+    filtered = true;
   }
 
-  if (0) {
-    // TODO: filtered result
-    goto success;
-  } else {
-    // encode attribute ids as cbor array
+  if (filtered) {
+    // encode selected attribute identifiers and values as cbor map
     QCBOREncode_Init(&cec, response_buffer);
-    QCBOREncode_OpenArray(&cec);
-    for (int i = 0; i < cluster->attributes_length; i++) {
-      QCBOREncode_AddUInt64(&cec, cluster->attributes[i]->id);
+    QCBOREncode_OpenMap(&cec);
+    for (size_t i = 0; i < cluster->attributes_length; i++) {
+      if ((selected[i / 8] & (1 << (i % 8))) == 0)
+        continue;
+
+      char buffer[1024]; // TODO: estimate buffer size QQ
+      dd_attribute *attribute = cluster->attributes[i];
+      dd_cbor_add_value_keyn(
+          &cec, attribute->id,
+          dd_attribute_read(attribute, buffer, sizeof(buffer)));
     }
-    QCBOREncode_CloseArray(&cec);
+    QCBOREncode_CloseMap(&cec);
     QCBORError ceerr = QCBOREncode_Finish(&cec, &response_result);
-    assert(ceerr == QCBOR_SUCCESS);
+    if (ceerr != QCBOR_SUCCESS) {
+      // too many values for response buffer
+      printf("encoding filtered attributes failed!\n");
+      response->code = COAP_RESPONSE_CODE(500);
+      return;
+    }
 
-    // attach list to response
+    // attach values to response
     coap_add_data_blocked_response(resource, session, request, response, token,
                                    COAP_MEDIATYPE_APPLICATION_CBOR, -1,
                                    response_result.len, response_result.ptr);
 
     // deliver
     goto success_content;
-  }
+  } else {
+    // attach attribute ids, encoded as cbor array by codegen
+    coap_add_data_blocked_response(resource, session, request, response, token,
+                                   COAP_MEDIATYPE_APPLICATION_CBOR, -1,
+                                   cluster->attributes_cbor_length,
+                                   cluster->attributes_cbor);
 
-success:
-  // 200 empty return case
-  response->code = COAP_RESPONSE_CODE(200);
-  return;
+    // deliver
+    goto success_content;
+  }
 
 success_content:
   // 205 content return case
@@ -990,6 +937,98 @@ error:
   return;
 }
 
+/*
+ * check value against attribute type and range
+ *
+ * returns:
+ * - zcl status code, success if value can be passed to write handler
+ */
+static uint8_t dd_attribute_check_value(dd_attribute *attribute,
+                                        dd_value *value) {
+  assert(attribute != 0);
+  assert(value != 0);
+
+  switch (attribute->type) {
+  case DD_INT:
+  case DD_UINT:
+    // Note: non-negative integers decode as unsigned, negative as signed
+    if (value->type == DD_INT) {
+      if (value->value.vint < attribute->min ||
+          value->value.vint > attribute->max)
+        return DD_ZCL_INVALID_VALUE;
+      return DD_ZCL_SUCCESS;
+    } else if (value->type == DD_UINT) {
+      if (value->value.vuint > (uint64_t)attribute->max)
+        return DD_ZCL_INVALID_VALUE;
+      return DD_ZCL_SUCCESS;
+    }
+    return DD_ZCL_INVALID_DATA_TYPE;
+  default:
+    if (value->type != attribute->type)
+      return DD_ZCL_INVALID_DATA_TYPE;
+    return DD_ZCL_SUCCESS;
+  }
+}
+
+/*
+ * decode next aid -> value pair of attribute mass update and check it against
+ * cluster attributes
+ *
+ * returns:
+ * - -1 on malformed entry
+ * -  0 on success, status set; attribute and value valid on zcl success
+ */
+static int dd_handle_attributes__parse_entry(QCBORDecodeContext *ctx,
+                                             dd_cluster *cluster, void *buffer,
+                                             size_t buffer_size, uint16_t *aid,
+                                             dd_attribute **attribute,
+                                             dd_value **value,
+                                             uint8_t *status) {
+  assert(ctx != 0);
+  assert(cluster != 0);
+  assert(buffer != 0);
+  assert(aid != 0);
+  assert(attribute != 0);
+  assert(value != 0);
+  assert(status != 0);
+  QCBORItem item;
+  QCBORError cderr;
+
+  // get key-value pair aid -> value
+  cderr = QCBORDecode_GetNext(ctx, &item);
+  if (cderr != QCBOR_SUCCESS ||
+      item.uLabelType !=
+          QCBOR_TYPE_INT64 /* everything <= int64_max reports int64 */
+      || 0 > item.label.int64 || item.label.int64 > UINT16_MAX) {
+    fprintf(stderr, "label not uint16\n");
+    return -1;
+  }
+  if (item.uDataType == QCBOR_TYPE_MAP || item.uDataType == QCBOR_TYPE_ARRAY) {
+    // nested items would be consumed as following entries
+    fprintf(stderr, "value not a simple type\n");
+    return -1;
+  }
+  *aid = item.label.int64;
+
+  // find attribute
+  size_t index = dd_attributes_lower_bound(cluster, *aid);
+  if (index >= cluster->attributes_length ||
+      cluster->attributes[index]->id != *aid) {
+    *status = DD_ZCL_UNSUPPORTED_ATTRIBUTE;
+    return 0;
+  }
+  *attribute = cluster->attributes[index];
+
+  // decode and check value
+  *value = dd_cbor_get_value(&item, buffer, buffer_size);
+  if (*value == 0) {
+    *status = DD_ZCL_INVALID_DATA_TYPE;
+    return 0;
+  }
+  *status = dd_attribute_check_value(*attribute, *value);
+  return 0;
+}
+
 // POST /zcl/e/<eid>/<cl>/a
 void dd_handle_attributes_post(dd_device *device, dd_endpoint *endpoint,
                                dd_cluster *cluster,
@@ -997,7 +1036,93 @@ void dd_handle_attributes_post(dd_device *device, dd_endpoint *endpoint,
                                coap_session_t *session, coap_pdu_t *request,
                                coap_binary_t *token, coap_string_t *query,
                                coap_pdu_t *response) {
-  printf("attribute mass update not implemented ...\n");
+  assert(device != 0);
+  assert(endpoint != 0);
+  assert(cluster != 0);
+  QCBORDecodeContext cdc;
+  UsefulBufC request_buffer;
+  QCBORItem item;
+  QCBORError cderr;
+  QCBOREncodeContext cec;
+  UsefulBuf_MAKE_STACK_UB(response_buffer,
+                          1024); // TODO: use meaningful estimate
+  UsefulBufC response_result = NULLUsefulBufC;
+  char buffer[1024]; // TODO: better size prediction
+  uint16_t nentries;
+  uint16_t aid;
+  dd_attribute *attribute;
+  dd_value *value;
+  uint8_t status;
+
+  // parse payload
+  if (coap_get_data(request, &request_buffer.len,
+                    (uint8_t **)&request_buffer.ptr) != 1) {
+    fprintf(stderr, "no payload\n");
+    goto dd_handle_attributes_post__400;
+  }
+  // TODO: validate encoding declaration (coap)
+
+  /*
+   * first pass: check every entry, encode status per attribute.
+   * Nothing is written unless the whole payload is well-formed.
+   */
+  QCBORDecode_Init(&cdc, request_buffer, QCBOR_DECODE_MODE_NORMAL);
+
+  // expect a map: attribute id -> value
+  cderr = QCBORDecode_GetNext(&cdc, &item);
+  if (cderr != QCBOR_SUCCESS || item.uDataType != QCBOR_TYPE_MAP ||
+      item.val.uCount == 0) {
+    fprintf(stderr, "not map with items, instead type=%i, count=%u\n",
+            item.uDataType, item.val.uCount);
+    goto dd_handle_attributes_post__400;
+  }
+  nentries = item.val.uCount;
+
+  QCBOREncode_Init(&cec, response_buffer);
+  QCBOREncode_OpenMap(&cec);
+  for (uint16_t i = 0; i < nentries; i++) {
+    if (dd_handle_attributes__parse_entry(&cdc, cluster, buffer,
+                                          sizeof(buffer), &aid, &attribute,
+                                          &value, &status) != 0)
+      goto dd_handle_attributes_post__400;
+    QCBOREncode_AddUInt64ToMapN(&cec, aid, status);
+  }
+  QCBOREncode_CloseMap(&cec);
+  if (QCBORDecode_Finish(&cdc) != QCBOR_SUCCESS) {
+    fprintf(stderr, "trailing data after map\n");
+    goto dd_handle_attributes_post__400;
+  }
+  QCBORError ceerr = QCBOREncode_Finish(&cec, &response_result);
+  if (ceerr != QCBOR_SUCCESS) {
+    // too many entries for response buffer
+    printf("encoding attribute status failed!\n");
+    response->code = COAP_RESPONSE_CODE(500);
+    return;
+  }
+
+  // second pass: write all accepted values in one go
+  QCBORDecode_Init(&cdc, request_buffer, QCBOR_DECODE_MODE_NORMAL);
+  cderr = QCBORDecode_GetNext(&cdc, &item);
+  assert(cderr == QCBOR_SUCCESS);
+  for (uint16_t i = 0; i < nentries; i++) {
+    int ret = dd_handle_attributes__parse_entry(
+        &cdc, cluster, buffer, sizeof(buffer), &aid, &attribute, &value,
+        &status);
+    assert(ret == 0);
+    if (status == DD_ZCL_SUCCESS)
+      dd_attribute_write(attribute, value);
+  }
+
+  // respond with status per attribute
+  response->code = COAP_RESPONSE_CODE(204);
+  coap_add_data_blocked_response(resource, session, request, response, token,
+                                 COAP_MEDIATYPE_APPLICATION_CBOR, -1,
+                                 response_result.len, response_result.ptr);
+  return;
+
+dd_handle_attributes_post__400:
+  response->code = COAP_RESPONSE_CODE(400);
+  return;
 }
 
 // GET /zcl/e/<eid>/<cl>/a/<aid>
@@ -1015,13 +1140,37 @@ void dd_handle_attribute_get(dd_device *device, dd_endpoint *endpoint,
   UsefulBuf_MAKE_STACK_UB(response_buffer,
                           1024); // TODO: use meaningful estimate
   UsefulBufC response_result = NULLUsefulBufC;
+  uint8_t etag[8];
+  bool valid = false;
+
+  // only versioned (cached) attributes can be tagged without reading them
+  if (attribute->cache.version != 0) {
+    dd_make_etag(etag, attribute->cache.version);
+    valid = dd_match_etag(request, etag, sizeof(etag));
+    coap_add_option(response, COAP_OPTION_ETAG, sizeof(etag), etag);
+  }
+
+  // confirm registration or notify, before any higher numbered options
+  if (coap_find_observer(resource, session, token) != 0) {
+    uint8_t observe[4];
+    coap_add_option(response, COAP_OPTION_OBSERVE,
+                    coap_encode_var_safe(observe, sizeof(observe),
+                                         resource->observe),
+                    observe);
+  }
+
+  if (valid) {
+    // client representation is current, respond with 203 Valid
+    response->code = COAP_RESPONSE_CODE(203);
+    return;
+  }
 
   // encode attribute identifier and value as cbor map
   QCBOREncode_Init(&cec, response_buffer);
   QCBOREncode_OpenMap(&cec);
   char buffer[1024]; // TODO: estimate buffer size QQ
   dd_cbor_add_value_keyn(&cec, attribute->id,
-                         attribute->read(buffer, sizeof(buffer)));
+                         dd_attribute_read(attribute, buffer, sizeof(buffer)));
   QCBOREncode_CloseMap(&cec);
   QCBORError ceerr = QCBOREncode_Finish(&cec, &response_result);
   assert(ceerr == QCBOR_SUCCESS);
@@ -1092,8 +1241,13 @@ void dd_handle_attribute_put(dd_device *device, dd_endpoint *endpoint,
     goto dd_handle_attribute_put__400;
   }
 
-  attribute->write(value);
-  // TODO: data type mismatch possible, handle as 400 ...
+  if (dd_attribute_check_value(attribute, value) != DD_ZCL_SUCCESS) {
+    // TODO: zcl status code
+    fprintf(stderr, "value does not match attribute type\n");
+    goto dd_handle_attribute_put__400;
+  }
+
+  dd_attribute_write(attribute, value);
   goto dd_handle_attribute_put__204;
 
 dd_handle_attribute_put__204:
@@ -1105,6 +1259,152 @@ dd_handle_attribute_put__400:
   return;
 }
 
+/*
+ * per binding notification envelope: destination uri-path options, content
+ * format and encoded sender uri "u"
+ *
+ * Note: built on first notification after binding was created or updated.
+ */
+struct dd_binding_envelope {
+  bool valid;
+  // uri-path options, as split by libcoap
+  uint8_t path[64];
+  size_t path_length;
+  int path_segments;
+  uint8_t content_format[4];
+  size_t content_format_length;
+  // encoded sender uri
+  uint8_t sender_buffer[48];
+  UsefulBufC sender;
+};
+typedef struct dd_binding_envelope dd_binding_envelope;
+
+// volatile envelopes, by binding id
+static dd_binding_envelope binding_envelopes[UINT8_MAX + 1];
+
+// volatile reporting state, by binding id
+static dd_binding_state binding_states[UINT8_MAX + 1];
+
+/*
+ * confirmable notification awaiting acknowledgement
+ */
+struct dd_outstanding_notification {
+  coap_session_t *session; // 0 if unused
+  coap_tid_t tid;
+  time_t sent;
+  uint8_t bindings[(UINT8_MAX + 1) / 8]; // ids of bindings packed, as bitmap
+};
+typedef struct dd_outstanding_notification dd_outstanding_notification;
+
+static struct {
+  dd_outstanding_notification queue[DD_NOTIFICATIONS_OUTSTANDING_MAX];
+  uint8_t retries[UINT8_MAX + 1]; // by binding id
+  dd_notification_stats stats;
+} delivery;
+
+/*
+ * forget volatile state of binding, as its id is reused once deleted
+ *
+ * Note: called when binding is created, updated or deleted.
+ */
+static void dd_reset_binding(dd_binding *binding) {
+  assert(binding != 0);
+  uint8_t bid = binding->id;
+
+  binding_envelopes[bid].valid = false;
+  bzero(&binding_states[bid], sizeof(dd_binding_state));
+  delivery.retries[bid] = 0;
+  // outcome of notifications in flight no longer concerns this binding
+  for (size_t i = 0; i < DD_NOTIFICATIONS_OUTSTANDING_MAX; i++)
+    delivery.queue[i].bindings[bid / 8] &= ~(1 << (bid % 8));
+}
+
+/*
+ * check whether destination path of uri fits into uri-path options of an
+ * envelope, at up to 2 header bytes per segment: option deltas after the first
+ * are 0, and segments within the envelope are shorter than 269 bytes
+ */
+static bool dd_envelope_fits(const dd_uri *uri) {
+  assert(uri != 0);
+
+  const char *path = dd_uri_path(uri);
+  if (path[0] == '/')
+    path++;
+  size_t path_length = strlen(path);
+  size_t segments = 1;
+  for (size_t i = 0; i < path_length; i++) {
+    if (path[i] == '/')
+      segments++;
+  }
+
+  return path_length + 2 * segments + 1 <= sizeof(binding_envelopes[0].path);
+}
+
+/*
+ * get envelope of binding, building it if invalid
+ *
+ * returns:
+ * -  0 if destination or sender uri exceed envelope
+ */
+static dd_binding_envelope *dd_make_envelope(dd_endpoint *endpoint,
+                                             dd_cluster *cluster,
+                                             dd_binding *binding) {
+  assert(endpoint != 0);
+  assert(cluster != 0);
+  assert(binding != 0);
+  dd_binding_envelope *envelope = &binding_envelopes[binding->id];
+  QCBOREncodeContext cec;
+
+  if (envelope->valid)
+    return envelope;
+
+  // split destination path into uri-path options, without leading slash
+  dd_uri *uri = dd_binding_uri(binding);
+  if (!dd_envelope_fits(uri)) {
+    // checked when binding was created or updated
+    return 0;
+  }
+  const char *path = dd_uri_path(uri);
+  if (path[0] == '/')
+    path++;
+  size_t path_length = strlen(path);
+  envelope->path_length = sizeof(envelope->path);
+  envelope->path_segments =
+      coap_split_path((const uint8_t *)path, path_length, envelope->path,
+                      &envelope->path_length);
+
+  envelope->content_format_length =
+      coap_encode_var_safe(envelope->content_format,
+                           sizeof(envelope->content_format),
+                           COAP_MEDIATYPE_APPLICATION_CBOR);
+
+  { // build sender uri
+    char sender_uri_buffer[1024];
+    dd_uri *sender_uri = (void *)sender_uri_buffer;
+    bzero(sender_uri, sizeof(dd_uri));
+    dd_ref_set(&sender_uri->host, sender_uri->_buffer + sender_uri->length);
+    memcpy(sender_uri->_buffer + sender_uri->length, "localhost",
+           sizeof("localhost"));
+    sender_uri->length += sizeof("localhost"); // TODO: real hostname
+    dd_ref_set(&sender_uri->path, sender_uri->_buffer + sender_uri->length);
+    sender_uri->length += snprintf(
+        sender_uri->_buffer + sender_uri->length,
+        sizeof(sender_uri_buffer) - sizeof(dd_uri) - sender_uri->length,
+        "/zcl/e/%x/%c%x", endpoint->id, cluster->role, cluster->id);
+
+    QCBOREncode_Init(&cec, (UsefulBuf){envelope->sender_buffer,
+                                       sizeof(envelope->sender_buffer)});
+    dd_cbor_add_uri(&cec, sender_uri);
+    if (QCBOREncode_Finish(&cec, &envelope->sender) != QCBOR_SUCCESS) {
+      // sender uri exceeds envelope
+      return 0;
+    }
+  }
+
+  envelope->valid = true;
+  return envelope;
+}
+
 // GET /zcl/e/<eid>/<cl>/b
 void dd_handle_bindings_get(dd_device *device, dd_endpoint *endpoint,
                             dd_cluster *cluster,
@@ -1119,6 +1419,15 @@ void dd_handle_bindings_get(dd_device *device, dd_endpoint *endpoint,
   UsefulBuf_MAKE_STACK_UB(response_buffer,
                           1024); // TODO: use meaningful estimate
   UsefulBufC response_result = NULLUsefulBufC;
+  uint8_t etag[8];
+
+  // tag with table generation, respond with 203 Valid if client is current
+  dd_make_etag(etag, cluster->bindings_generation);
+  coap_add_option(response, COAP_OPTION_ETAG, sizeof(etag), etag);
+  if (dd_match_etag(request, etag, sizeof(etag))) {
+    response->code = COAP_RESPONSE_CODE(203);
+    return;
+  }
 
   // encode binding ids as cbor array
   QCBOREncode_Init(&cec, response_buffer);
@@ -1139,26 +1448,31 @@ void dd_handle_bindings_get(dd_device *device, dd_endpoint *endpoint,
 
 static void dd_handle_bindings__parse_entry(QCBORDecodeContext *ctx,
                                             uint8_t *rid, dd_uri **uri,
-                                            void *buffer, size_t buffer_size) {
+                                            bool *confirmable, void *buffer,
+                                            size_t buffer_size) {
   assert(ctx != 0);
   assert(uri != 0);
   assert(rid != 0);
+  assert(confirmable != 0);
   assert(buffer != 0);
   QCBORError cderr;
   QCBORItem item;
 
   // expect map with report id and uri: r -> <rid> [, u -> <uri>]
+  // [, c -> <confirmable>]
   cderr = QCBORDecode_GetNext(ctx, &item);
   if (cderr != QCBOR_SUCCESS || item.uDataType != QCBOR_TYPE_MAP ||
-      item.val.uCount == 0 || item.val.uCount > 2) {
+      item.val.uCount == 0 || item.val.uCount > 3) {
     return;
   }
+  uint16_t nitems = item.val.uCount;
   int64_t _rid = 0;
   dd_uri *_uri = 0;
-  for (int i = 0; i < 2; i++) {
+  bool _confirmable = false;
+  for (uint16_t i = 0; i < nitems; i++) {
     cderr = QCBORDecode_GetNext(ctx, &item);
-    // expect "r" or "u" string keys
-    if (item.uLabelType != QCBOR_TYPE_TEXT_STRING ||
+    // expect "r", "u" or "c" string keys
+    if (cderr != QCBOR_SUCCESS || item.uLabelType != QCBOR_TYPE_TEXT_STRING ||
         item.label.string.len != 1) {
       return;
     }
@@ -1175,6 +1489,12 @@ static void dd_handle_bindings__parse_entry(QCBORDecodeContext *ctx,
         return;
       }
       // TODO: verify uri???
+    } else if (((const char *)item.label.string.ptr)[0] == 'c') {
+      if (item.uDataType != QCBOR_TYPE_TRUE &&
+          item.uDataType != QCBOR_TYPE_FALSE) {
+        return;
+      }
+      _confirmable = item.uDataType == QCBOR_TYPE_TRUE;
     } else {
       return;
     }
@@ -1182,6 +1502,7 @@ static void dd_handle_bindings__parse_entry(QCBORDecodeContext *ctx,
 
   *uri = _uri;
   *rid = _rid;
+  *confirmable = _confirmable;
 }
 
 // POST /zcl/e/<eid>/<cl>/b
@@ -1207,9 +1528,10 @@ void dd_handle_bindings_post(dd_device *device, dd_endpoint *endpoint,
   QCBORDecode_Init(&cdc, request_buffer, QCBOR_DECODE_MODE_NORMAL);
   uint8_t rid = 0;
   dd_uri *uri = 0;
+  bool confirmable = false;
   char uri_buffer[100]; // TODO: use meaningful estimate
-  dd_handle_bindings__parse_entry(&cdc, &rid, &uri, (void *)uri_buffer,
-                                  sizeof(uri_buffer));
+  dd_handle_bindings__parse_entry(&cdc, &rid, &uri, &confirmable,
+                                  (void *)uri_buffer, sizeof(uri_buffer));
   // QCBORDecode_Finish(&cdc); // TODO??
 
   if (uri == 0) {
@@ -1217,15 +1539,16 @@ void dd_handle_bindings_post(dd_device *device, dd_endpoint *endpoint,
     // TODO: zcl status code
     goto dd_handle_bindings_post__400;
   }
+  if (!dd_envelope_fits(uri)) {
+    // destination path too long to notify
+    // TODO: zcl status code
+    goto dd_handle_bindings_post__400;
+  }
 
   // look-up report configuration
   dd_report *report = 0;
   if (rid != 0) {
-    for (size_t i = 0; i < cluster->reports_length; i++) {
-      if (cluster->reports[i] != 0 && cluster->reports[i]->id == rid) {
-        report = cluster->reports[i];
-      }
-    }
+    report = dd_find_report(cluster, rid);
     if (report == 0) {
       // report id does not exist
       // TODO: zcl status code
@@ -1238,8 +1561,9 @@ void dd_handle_bindings_post(dd_device *device, dd_endpoint *endpoint,
   dd_binding *candidate = (void *)buffer;
   bzero(candidate, sizeof(dd_binding));
   dd_copy_uri(candidate->_buffer, sizeof(buffer) - sizeof(dd_binding), uri);
-  candidate->uri = (void *)candidate->_buffer;
+  dd_ref_set(&candidate->uri, candidate->_buffer);
   candidate->rid = rid;
+  candidate->confirmable = confirmable;
   candidate->length = sizeof(dd_uri) + uri->length;
 
   // TODO: find duplicate entry in bindings table ...
@@ -1253,12 +1577,16 @@ void dd_handle_bindings_post(dd_device *device, dd_endpoint *endpoint,
 
   // insert to storage
   dd_binding *binding =
-      dd_storage_bindings_put(endpoint->id, cluster->id, candidate);
+      dd_storage_bindings_put(endpoint->id, cluster->role, cluster->id,
+                              candidate);
   if (binding == 0) {
     // storage full
     goto dd_handle_bindings_post__500;
   }
-  cluster->bindings[cluster->bindings_length++] = binding;
+  int ret = dd_insert_binding(cluster, binding);
+  assert(ret == 0); // capacity checked above
+  dd_reset_binding(binding);
+  dd_schedule_binding(endpoint, cluster, binding);
 
   // return success + uri of new binding
   {
@@ -1304,8 +1632,10 @@ void dd_handle_binding_get(dd_device *device, dd_endpoint *endpoint,
   // encode binding entry as cbor map
   QCBOREncode_Init(&cec, response_buffer);
   QCBOREncode_OpenMap(&cec);
-  dd_cbor_add_uri_key(&cec, "u", binding->uri);
+  dd_cbor_add_uri_key(&cec, "u", dd_binding_uri(binding));
   QCBOREncode_AddUInt64ToMap(&cec, "r", binding->rid);
+  if (binding->confirmable)
+    QCBOREncode_AddBoolToMap(&cec, "c", true);
   QCBOREncode_CloseMap(&cec);
   QCBORError ceerr = QCBOREncode_Finish(&cec, &response_result);
   assert(ceerr == QCBOR_SUCCESS);
@@ -1343,27 +1673,29 @@ void dd_handle_binding_put(dd_device *device, dd_endpoint *endpoint,
   }
   // TODO: validate encoding declaration (coap)
   QCBORDecode_Init(&cdc, request_buffer, QCBOR_DECODE_MODE_NORMAL);
+  dd_uri *uri = 0;
   dd_handle_bindings__parse_entry(
-      &cdc, &candidate->rid, &candidate->uri, candidate->_buffer,
+      &cdc, &candidate->rid, &uri, &candidate->confirmable, candidate->_buffer,
       sizeof(candidate_buffer) - sizeof(dd_binding));
   // QCBORDecode_Finish(&cdc); // TODO??
 
-  if (candidate->uri == 0) {
+  if (uri == 0) {
     // uri is required
     // TODO: zcl status code
     goto dd_handle_binding_put__400;
   }
-  candidate->length += candidate->uri->length;
+  if (!dd_envelope_fits(uri)) {
+    // destination path too long to notify
+    // TODO: zcl status code
+    goto dd_handle_binding_put__400;
+  }
+  dd_ref_set(&candidate->uri, uri);
+  candidate->length += sizeof(dd_uri) + uri->length;
 
   // look-up report configuration
   dd_report *report = 0;
   if (candidate->rid != 0) {
-    for (size_t i = 0; i < cluster->reports_length; i++) {
-      if (cluster->reports[i] != 0 &&
-          cluster->reports[i]->id == candidate->rid) {
-        report = cluster->reports[i];
-      }
-    }
+    report = dd_find_report(cluster, candidate->rid);
     if (report == 0) {
       // report id does not exist
       // TODO: zcl status code
@@ -1374,11 +1706,12 @@ void dd_handle_binding_put(dd_device *device, dd_endpoint *endpoint,
   // check for duplicate
   for (size_t i = 0; i < cluster->bindings_length; i++) {
     dd_binding *other = cluster->bindings[i];
+    if (other == binding) {
+      // rewriting binding unchanged is no duplicate
+      continue;
+    }
     if (other->rid == candidate->rid &&
-        candidate->uri->scheme == other->uri->scheme &&
-        strcmp(candidate->uri->host, other->uri->host) == 0 &&
-        candidate->uri->port == other->uri->port &&
-        strcmp(candidate->uri->path, other->uri->path) == 0) {
+        dd_uri_equals(uri, dd_binding_uri(other))) {
       // duplicate detected
       // TODO: ZCL status code DUPLICATE_EXISTS
       goto dd_handle_binding_put__400;
@@ -1386,7 +1719,16 @@ void dd_handle_binding_put(dd_device *device, dd_endpoint *endpoint,
   }
 
   // update binding
-  dd_storage_bindings_update(binding, candidate);
+  if (dd_storage_bindings_update(binding, candidate) == 0) {
+    // exceeds row, or not durable
+    goto dd_handle_binding_put__500;
+  }
+  dd_link_binding(cluster, binding);
+  dd_reset_binding(binding);
+  cluster->bindings_generation++;
+  // report may have changed, pick new jitter offset
+  dd_unschedule_binding(binding);
+  dd_schedule_binding(endpoint, cluster, binding);
   // TODO: also update pointer in resource tree ... ?
 
   // done
@@ -1399,6 +1741,10 @@ dd_handle_binding_put__204:
 dd_handle_binding_put__400:
   response->code = COAP_RESPONSE_CODE(400);
   return;
+
+dd_handle_binding_put__500:
+  response->code = COAP_RESPONSE_CODE(500);
+  return;
 }
 
 // DELETE /zcl/e/<eid>/<cl>/<bid>
@@ -1413,19 +1759,10 @@ void dd_handle_binding_delete(dd_device *device, dd_endpoint *endpoint,
   assert(cluster != 0);
   assert(binding != 0);
 
-  // delete from resource tree
-  int deleted = 0;
-  for (size_t i = 0; i < cluster->bindings_length; i++) {
-    if (cluster->bindings[i]->id == binding->id) {
-      while (++i < cluster->bindings_length) {
-        cluster->bindings[i - 1] = cluster->bindings[i];
-      }
-      cluster->bindings_length--;
-      cluster->bindings[cluster->bindings_length] = 0;
-      deleted = 1;
-    }
-  }
-  assert(deleted == 1);
+  // delete from resource tree and schedule
+  dd_remove_binding(cluster, binding);
+  dd_unschedule_binding(binding);
+  dd_reset_binding(binding);
 
   // delete from storage
   dd_storage_bindings_delete(binding);
@@ -1436,34 +1773,22 @@ void dd_handle_binding_delete(dd_device *device, dd_endpoint *endpoint,
 
 // GET /zcl/e/<eid>/<cl>/c
 void dd_handle_commands_get(dd_device *device, dd_endpoint *endpoint,
-                            dd_cluster *cluster,
-                            struct coap_resource_t *resource,
-                            coap_session_t *session, coap_pdu_t *request,
-                            coap_binary_t *token, coap_string_t *query,
-                            coap_pdu_t *response) {
-  assert(device != 0);
-  assert(endpoint != 0);
-  assert(cluster != 0);
-  QCBOREncodeContext cec;
-  UsefulBuf_MAKE_STACK_UB(response_buffer,
-                          1024); // TODO: estimate meaningful size
-  UsefulBufC response_result = NULLUsefulBufC;
-
-  // encode commands as cbor array
-  QCBOREncode_Init(&cec, response_buffer);
-  QCBOREncode_OpenArray(&cec);
-  for (int i = 0; i < cluster->commands_length; i++) {
-    QCBOREncode_AddUInt64(&cec, cluster->commands[i]->id);
-  }
-  QCBOREncode_CloseArray(&cec);
-  QCBORError ceerr = QCBOREncode_Finish(&cec, &response_result);
-  assert(ceerr == QCBOR_SUCCESS);
+                            dd_cluster *cluster,
+                            struct coap_resource_t *resource,
+                            coap_session_t *session, coap_pdu_t *request,
+                            coap_binary_t *token, coap_string_t *query,
+                            coap_pdu_t *response) {
+  assert(device != 0);
+  assert(endpoint != 0);
+  assert(cluster != 0);
 
   // respond with 205 Content, media type application/cbor
+  // command identifiers were encoded as cbor array by codegen
   response->code = COAP_RESPONSE_CODE(205);
   coap_add_data_blocked_response(resource, session, request, response, token,
                                  COAP_MEDIATYPE_APPLICATION_CBOR, -1,
-                                 response_result.len, response_result.ptr);
+                                 cluster->commands_cbor_length,
+                                 cluster->commands_cbor);
 }
 
 // GET /zcl/e/<eid>/<cl>/c/<cid>
@@ -1485,62 +1810,53 @@ void dd_handle_command_post(dd_device *device, dd_endpoint *endpoint,
   response->code = COAP_RESPONSE_CODE(204);
 }
 
-// POST /zcl/e/<eid>/<cl>/n
-void dd_handle_notification_post(dd_device *device, dd_endpoint *endpoint,
-                                 dd_cluster *cluster,
-                                 struct coap_resource_t *resource,
-                                 coap_session_t *session, coap_pdu_t *request,
-                                 coap_binary_t *token, coap_string_t *query,
-                                 coap_pdu_t *response) {
-  assert(device != 0);
-  assert(endpoint != 0);
-  assert(cluster != 0);
-  char notification_buffer[1024];
-  UsefulBufC request_buffer;
-  QCBORDecodeContext cdc;
-  QCBORItem item;
+/*
+ * decode notification map, starting at its header item
+ *
+ * Note: notification uri is stored in buffer.
+ *
+ * returns:
+ * - -1 on malformed notification
+ * -  0 on success
+ */
+static int dd_handle_notification_post__parse(QCBORDecodeContext *ctx,
+                                              QCBORItem item, void *buffer,
+                                              size_t buffer_size,
+                                              dd_notification *notification) {
+  assert(ctx != 0);
+  assert(notification != 0);
   QCBORError cderr;
 
-  // parse payload
-  if (coap_get_data(request, &request_buffer.len,
-                    (uint8_t **)&request_buffer.ptr) != 1) {
-    // TODO: zcl status code
-    goto dd_handle_notification_post__400;
-  }
-  // TODO: validate encoding declaration (coap)
-  QCBORDecode_Init(&cdc, request_buffer, QCBOR_DECODE_MODE_NORMAL);
-
-  dd_notification notification = {0};
-  cderr = QCBORDecode_GetNext(&cdc, &item);
-  if (cderr != QCBOR_SUCCESS || item.uDataType != QCBOR_TYPE_MAP ||
-      item.val.uCount == 0 || item.val.uCount > 5) {
+  bzero(notification, sizeof(dd_notification));
+  if (item.uDataType != QCBOR_TYPE_MAP || item.val.uCount == 0 ||
+      item.val.uCount > 5) {
     // expect map with notification source and attribute values "u", "r", "b",
     // "t", "a"
-    goto dd_handle_notification_post__400;
+    return -1;
   }
   uint16_t nitems = item.val.uCount;
   for (uint16_t i = 0; i < nitems; i++) {
-    cderr = QCBORDecode_GetNext(&cdc, &item);
+    cderr = QCBORDecode_GetNext(ctx, &item);
     if (cderr != QCBOR_SUCCESS || item.uLabelType != QCBOR_TYPE_TEXT_STRING ||
         item.label.string.len != 1) {
       // expect string key length 1
-      goto dd_handle_notification_post__400;
+      return -1;
     }
     switch (((const char *)item.label.string.ptr)[0]) {
     case 'a': {
       if (item.uDataType != QCBOR_TYPE_MAP) {
         // expect map with attributes id => value pairs
-        goto dd_handle_notification_post__400;
+        return -1;
       }
       uint16_t nattributes = item.val.uCount;
       for (uint16_t j = 0; j < nattributes; j++) {
-        cderr = QCBORDecode_GetNext(&cdc, &item);
+        cderr = QCBORDecode_GetNext(ctx, &item);
         if (cderr != QCBOR_SUCCESS ||
             item.uLabelType !=
                 QCBOR_TYPE_INT64 /* everything <= int64_max reports int64 */
             || 0 > item.label.int64 || item.label.int64 > UINT16_MAX) {
           // expect attribute id (uint16) key
-          goto dd_handle_notification_post__400;
+          return -1;
         }
         // TODO: extract value
       }
@@ -1551,48 +1867,112 @@ void dd_handle_notification_post(dd_device *device, dd_endpoint *endpoint,
               QCBOR_TYPE_INT64 /* everything <= int64_max reports int64 */
           || 0 > item.val.int64 || item.val.int64 > UINT8_MAX) {
         // expect uint8
-        goto dd_handle_notification_post__400;
+        return -1;
       }
-      notification.bid = item.val.int64;
+      notification->bid = item.val.int64;
       break;
     case 'r':
       if (item.uDataType !=
               QCBOR_TYPE_INT64 /* everything <= int64_max reports int64 */
           || 0 > item.val.int64 || item.val.int64 > UINT8_MAX) {
         // expect uint8
-        goto dd_handle_notification_post__400;
+        return -1;
       }
-      notification.rid = item.val.int64;
+      notification->rid = item.val.int64;
       break;
     case 't':
       if (item.uDataType != QCBOR_TYPE_DATE_EPOCH) {
         // expect unixtime
-        goto dd_handle_notification_post__400;
+        return -1;
       }
-      notification.timestamp = item.val.int64;
+      notification->timestamp = item.val.int64;
       break;
     case 'u':
-      notification.uri = dd_cbor_get_uri(&item, notification_buffer,
-                                         sizeof(notification_buffer));
-      if (notification.uri == 0) {
+      notification->uri = dd_cbor_get_uri(&item, buffer, buffer_size);
+      if (notification->uri == 0) {
         // parsing failed
-        goto dd_handle_notification_post__400;
+        return -1;
       }
       break;
     default:
-      goto dd_handle_notification_post__400;
+      return -1;
     }
   }
 
   // TODO: check if all required fields were provided
 
-  // call user notification handler
+  return 0;
+}
+
+// POST /zcl/e/<eid>/<cl>/n
+void dd_handle_notification_post(dd_device *device, dd_endpoint *endpoint,
+                                 dd_cluster *cluster,
+                                 struct coap_resource_t *resource,
+                                 coap_session_t *session, coap_pdu_t *request,
+                                 coap_binary_t *token, coap_string_t *query,
+                                 coap_pdu_t *response) {
+  assert(device != 0);
+  assert(endpoint != 0);
+  assert(cluster != 0);
+  char notification_buffer[1024];
+  UsefulBufC request_buffer;
+  QCBORDecodeContext cdc;
+  QCBORItem item;
+  QCBORError cderr;
+
+  // parse payload
+  if (coap_get_data(request, &request_buffer.len,
+                    (uint8_t **)&request_buffer.ptr) != 1) {
+    // TODO: zcl status code
+    goto dd_handle_notification_post__400;
+  }
+  // TODO: validate encoding declaration (coap)
+  QCBORDecode_Init(&cdc, request_buffer, QCBOR_DECODE_MODE_NORMAL);
+
+  dd_notification notification;
+  cderr = QCBORDecode_GetNext(&cdc, &item);
+  if (cderr != QCBOR_SUCCESS) {
+    goto dd_handle_notification_post__400;
+  }
   if (cluster->notify == 0) {
     // cluster does not support notifications
     // TODO: what is correct response code?
     goto dd_handle_notification_post__400;
   }
-  cluster->notify(&notification);
+
+  if (item.uDataType != QCBOR_TYPE_ARRAY) {
+    // single notification
+    if (dd_handle_notification_post__parse(&cdc, item, notification_buffer,
+                                           sizeof(notification_buffer),
+                                           &notification) != 0) {
+      goto dd_handle_notification_post__400;
+    }
+    cluster->notify(&notification);
+    goto dd_handle_notification_post__204;
+  }
+
+  // batched notifications, see dd_process_bindings
+  uint16_t nnotifications = item.val.uCount;
+  /*
+   * first pass: check every notification, so that a malformed batch is
+   * rejected as a whole.
+   * second pass: call user notification handler for each.
+   */
+  for (int pass = 0; pass < 2; pass++) {
+    QCBORDecode_Init(&cdc, request_buffer, QCBOR_DECODE_MODE_NORMAL);
+    QCBORDecode_GetNext(&cdc, &item); // array header, checked above
+    for (uint16_t i = 0; i < nnotifications; i++) {
+      cderr = QCBORDecode_GetNext(&cdc, &item);
+      if (cderr != QCBOR_SUCCESS ||
+          dd_handle_notification_post__parse(&cdc, item, notification_buffer,
+                                             sizeof(notification_buffer),
+                                             &notification) != 0) {
+        goto dd_handle_notification_post__400;
+      }
+      if (pass == 1)
+        cluster->notify(&notification);
+    }
+  }
 
   goto dd_handle_notification_post__204;
 
@@ -1619,6 +1999,15 @@ void dd_handle_reports_get(dd_device *device, dd_endpoint *endpoint,
   UsefulBuf_MAKE_STACK_UB(response_buffer,
                           1024); // TODO: estimate meaningful size
   UsefulBufC response_result = NULLUsefulBufC;
+  uint8_t etag[8];
+
+  // tag with table generation, respond with 203 Valid if client is current
+  dd_make_etag(etag, cluster->reports_generation);
+  coap_add_option(response, COAP_OPTION_ETAG, sizeof(etag), etag);
+  if (dd_match_etag(request, etag, sizeof(etag))) {
+    response->code = COAP_RESPONSE_CODE(203);
+    return;
+  }
 
   // encode report identifiers as cbor array
   QCBOREncode_Init(&cec, response_buffer);
@@ -1675,13 +2064,16 @@ static void dd_handle_reports__parse_entry(QCBORDecodeContext *ctx,
         return;
       }
       // parse all attribute configurations
-      _report->attributes = dd_cbor_get_report_attribute_configurations(
-          ctx, item.val.uCount, _report->_buffer,
-          report_buffer_size - sizeof(dd_report), &_report->attributes_length);
-      if (_report->attributes == 0) {
+      dd_report_attribute *attributes =
+          dd_cbor_get_report_attribute_configurations(
+              ctx, item.val.uCount, _report->_buffer,
+              report_buffer_size - sizeof(dd_report),
+              &_report->attributes_length);
+      if (attributes == 0) {
         // parsing failed - or 0 attribute configurations ...
         return;
       }
+      dd_ref_set(&_report->attributes, attributes);
       _report->length += _report->attributes_length;
       fields_parsed |= 1;
     } else if (((const char *)item.label.string.ptr)[0] == 'n') {
@@ -1768,12 +2160,14 @@ void dd_handle_reports_post(dd_device *device, dd_endpoint *endpoint,
   // TODO: create binding entry from uri and report id
 
   // write to persistent storage
-  report = dd_storage_reports_put(endpoint->id, cluster->id, report);
+  report = dd_storage_reports_put(endpoint->id, cluster->role, cluster->id,
+                                  report);
   if (report == 0) {
     // storage full
     goto dd_handle_reports_post__500;
   }
-  cluster->reports[cluster->reports_length++] = report;
+  int ret = dd_insert_report(cluster, report);
+  assert(ret == 0); // capacity checked above
 
   // return created + new resource uri "/zcl/e/<eid>/<cl>/r/<rid>"
   {
@@ -1819,20 +2213,23 @@ void dd_handle_report_get(dd_device *device, dd_endpoint *endpoint,
   QCBOREncode_Init(&cec, response_buffer);
   QCBOREncode_OpenMap(&cec);
   QCBOREncode_OpenMapInMap(&cec, "a");
-  for (dd_report_attribute *attribute_configuration = report->attributes;
-       attribute_configuration < report->attributes + report->attributes_length;
-       attribute_configuration +=
-       sizeof(dd_report_attribute) + attribute_configuration->length) {
+  for (dd_report_attribute *attribute_configuration =
+           dd_report_attribute_next(report, 0);
+       attribute_configuration != 0;
+       attribute_configuration =
+           dd_report_attribute_next(report, attribute_configuration)) {
     QCBOREncode_OpenMapInMapN(&cec, attribute_configuration->aid);
-    if (attribute_configuration->high_threshold != 0) {
-      dd_cbor_add_value_key(&cec, "h", attribute_configuration->high_threshold);
+    dd_value *value = dd_ref_get(&attribute_configuration->high_threshold);
+    if (value != 0) {
+      dd_cbor_add_value_key(&cec, "h", value);
     }
-    if (attribute_configuration->low_threshold != 0) {
-      dd_cbor_add_value_key(&cec, "l", attribute_configuration->low_threshold);
+    value = dd_ref_get(&attribute_configuration->low_threshold);
+    if (value != 0) {
+      dd_cbor_add_value_key(&cec, "l", value);
     }
-    if (attribute_configuration->reportable_change != 0) {
-      dd_cbor_add_value_key(&cec, "r",
-                            attribute_configuration->reportable_change);
+    value = dd_ref_get(&attribute_configuration->reportable_change);
+    if (value != 0) {
+      dd_cbor_add_value_key(&cec, "r", value);
     }
     QCBOREncode_CloseMap(&cec);
   }
@@ -1877,182 +2274,666 @@ void dd_handle_report_delete(dd_device *device, dd_endpoint *endpoint,
   assert(cluster != 0);
   assert(report != 0);
 
-  // delete from resource tree
-  int deleted = 0;
-  for (size_t i = 0; i < cluster->reports_length; i++) {
-    if (cluster->reports[i]->id == report->id) {
-      while (++i < cluster->reports_length) {
-        cluster->reports[i - 1] = cluster->reports[i];
-      }
-      cluster->reports_length--;
-      cluster->reports[cluster->reports_length] = 0;
-      deleted = 1;
-    }
-  }
-  assert(deleted == 1);
-
-  // update referencing bindings to null report configuration
+  // update referencing bindings to null report configuration, first: report
+  // ids are reused, a binding left behind would link to the next report
   for (size_t i = 0; i < cluster->bindings_length; i++) {
     if (cluster->bindings[i]->rid == report->id) {
-      cluster->bindings[i]->rid = 0;
-      dd_storage_bindings_update(cluster->bindings[i], cluster->bindings[i]);
+      // update copy, so that row is only written through storage
+      char candidate_buffer[1024]; // TODO: make meaningful estimate
+      dd_binding *candidate = dd_copy_binding(
+          candidate_buffer, sizeof(candidate_buffer), cluster->bindings[i]);
+      assert(candidate != 0);
+      candidate->rid = 0;
+      if (dd_storage_bindings_update(cluster->bindings[i], candidate) == 0) {
+        // not durable, keep report
+        goto dd_handle_report_delete__500;
+      }
+      dd_link_binding(cluster, cluster->bindings[i]);
+      dd_unschedule_binding(cluster->bindings[i]);
     }
   }
 
-  // delete from storage
+  // delete from resource tree and storage
+  dd_remove_report(cluster, report);
   dd_storage_reports_delete(report);
 
   // done
   response->code = COAP_RESPONSE_CODE(202);
+  return;
+
+dd_handle_report_delete__500:
+  response->code = COAP_RESPONSE_CODE(500);
+  return;
+}
+
+// FNV-1a
+static uint32_t dd_hash_string(const char *string) {
+  uint32_t hash = 2166136261u;
+  for (; *string != '\0'; string++) {
+    hash ^= (uint8_t)*string;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static double dd_value_to_number(dd_value *value) {
+  assert(value != 0);
+
+  switch (value->type) {
+  case DD_INT:
+    return value->value.vint;
+  case DD_UINT:
+    return value->value.vuint;
+  case DD_TIME:
+    return value->value.vtime;
+  default:
+    // not an analog type, e.g. threshold of wrong type
+    return 0;
+  }
+}
+
+static void dd_report_value_remember(dd_reported_value *last,
+                                     dd_value *value) {
+  assert(last != 0);
+  assert(value != 0);
+
+  last->valid = true;
+  last->type = value->type;
+  switch (value->type) {
+  case DD_BOOL:
+    last->value.vbool = value->value.vbool;
+    break;
+  case DD_STRING:
+    last->value.vhash = dd_hash_string(dd_value_to_string(value));
+    break;
+  default:
+    last->value.vnumber = dd_value_to_number(value);
+    break;
+  }
+}
+
+/*
+ * compare current attribute value against last reported value
+ *
+ * returns:
+ * - true if the change is reportable according to attribute configuration
+ */
+static bool dd_report_value_changed(dd_report_attribute *configuration,
+                                    dd_reported_value *last,
+                                    dd_reported_value *current) {
+  assert(configuration != 0);
+  assert(last != 0);
+  assert(current != 0);
+
+  if (!current->valid) {
+    // unreadable, let notification decide
+    return true;
+  }
+  if (!last->valid || last->type != current->type) {
+    // never reported
+    return true;
+  }
+
+  switch (current->type) {
+  case DD_BOOL:
+    return last->value.vbool != current->value.vbool;
+  case DD_STRING:
+    return last->value.vhash != current->value.vhash;
+  default:
+    break;
+  }
+
+  // analog types: threshold crossings, then reportable change
+  double previous = last->value.vnumber;
+  double value = current->value.vnumber;
+  dd_value *low = dd_ref_get(&configuration->low_threshold);
+  if (low != 0) {
+    double threshold = dd_value_to_number(low);
+    if ((previous < threshold) != (value < threshold))
+      return true;
+  }
+  dd_value *high = dd_ref_get(&configuration->high_threshold);
+  if (high != 0) {
+    double threshold = dd_value_to_number(high);
+    if ((previous > threshold) != (value > threshold))
+      return true;
+  }
+  dd_value *change = dd_ref_get(&configuration->reportable_change);
+  if (change != 0) {
+    double delta = value > previous ? value - previous : previous - value;
+    return delta >= dd_value_to_number(change);
+  }
+  return value != previous;
+}
+
+/*
+ * report evaluated once per tick, shared by all bindings referencing it
+ */
+struct dd_report_sample {
+  dd_report *report;
+  // current values, in order of report configuration
+  dd_reported_value values[DD_REPORT_ATTRIBUTES_MAX];
+  // pre-encoded attribute map; NULLUsefulBufC if it did not fit
+  UsefulBufC attributes;
+};
+typedef struct dd_report_sample dd_report_sample;
+
+// reports sampled in current tick, see dd_process_bindings
+static struct {
+  dd_report_sample samples[UINT8_MAX];
+  size_t samples_length;
+  uint8_t arena[4096]; // encoded attribute maps
+  size_t arena_length;
+} tick;
+
+/*
+ * read attributes of report once per tick, summarize them for change
+ * detection and encode them for notifications
+ */
+static dd_report_sample *dd_sample_report(dd_cluster *cluster,
+                                          dd_report *report) {
+  assert(cluster != 0);
+  assert(report != 0);
+  QCBOREncodeContext cec;
+
+  for (size_t i = 0; i < tick.samples_length; i++) {
+    if (tick.samples[i].report == report) {
+      // sampled already
+      return &tick.samples[i];
+    }
+  }
+
+  assert(tick.samples_length < UINT8_MAX);
+  dd_report_sample *sample = &tick.samples[tick.samples_length++];
+  bzero(sample, sizeof(dd_report_sample));
+  sample->report = report;
+
+  UsefulBuf arena = {tick.arena + tick.arena_length,
+                     sizeof(tick.arena) - tick.arena_length};
+  QCBOREncode_Init(&cec, arena);
+  QCBOREncode_OpenMap(&cec);
+  size_t i = 0;
+  for (dd_report_attribute *attribute_configuration =
+           dd_report_attribute_next(report, 0);
+       attribute_configuration != 0;
+       attribute_configuration =
+           dd_report_attribute_next(report, attribute_configuration), i++) {
+    dd_attribute *attribute =
+        dd_report_attribute_link(cluster, report, i, attribute_configuration);
+    assert(attribute != 0);
+
+    char buffer[1024]; // TODO: use meaningful estimate
+    dd_value *value = dd_attribute_read(attribute, buffer, sizeof(buffer));
+    if (value == 0) {
+      // unreadable, left out of notification
+      continue;
+    }
+    if (i < DD_REPORT_ATTRIBUTES_MAX)
+      dd_report_value_remember(&sample->values[i], value);
+    dd_cbor_add_value_keyn(&cec, attribute->id, value);
+  }
+  QCBOREncode_CloseMap(&cec);
+
+  if (QCBOREncode_Finish(&cec, &sample->attributes) != QCBOR_SUCCESS) {
+    // arena exhausted, notifications encode attributes themselves
+    sample->attributes = NULLUsefulBufC;
+  } else {
+    tick.arena_length += sample->attributes.len;
+  }
+
+  return sample;
+}
+
+/*
+ * evaluate report configuration of binding against last reported values
+ *
+ * returns:
+ * - true if any attribute changed enough to be reported
+ */
+static bool dd_report_changed(dd_cluster *cluster, dd_binding *binding,
+                              dd_report_sample *sample) {
+  assert(cluster != 0);
+  assert(binding != 0);
+  assert(sample != 0);
+  dd_binding_state *state = &binding_states[binding->id];
+  dd_report *report = sample->report;
+
+  if (state->rid != report->id ||
+      state->reports_generation != cluster->reports_generation) {
+    // values belong to another report configuration
+    return true;
+  }
+
+  size_t i = 0;
+  for (dd_report_attribute *attribute_configuration =
+           dd_report_attribute_next(report, 0);
+       attribute_configuration != 0;
+       attribute_configuration =
+           dd_report_attribute_next(report, attribute_configuration), i++) {
+    if (i >= DD_REPORT_ATTRIBUTES_MAX) {
+      // not tracked
+      return true;
+    }
+
+    if (dd_report_value_changed(attribute_configuration, &state->values[i],
+                                &sample->values[i]))
+      return true;
+  }
+
+  return false;
+}
+
+/*
+ * remember values just reported for binding
+ */
+static void dd_report_remember(dd_cluster *cluster, dd_binding *binding,
+                               dd_report_sample *sample) {
+  assert(cluster != 0);
+  assert(binding != 0);
+  assert(sample != 0);
+  dd_binding_state *state = &binding_states[binding->id];
+
+  state->rid = sample->report->id;
+  state->reports_generation = cluster->reports_generation;
+  memcpy(state->values, sample->values, sizeof(state->values));
+}
+
+const dd_notification_stats *dd_get_notification_stats() {
+  return &delivery.stats;
+}
+
+/*
+ * check whether another confirmable notification may be sent to session
+ */
+static bool dd_delivery_available(coap_session_t *session) {
+  assert(session != 0);
+  size_t outstanding = 0, to_session = 0;
+
+  for (size_t i = 0; i < DD_NOTIFICATIONS_OUTSTANDING_MAX; i++) {
+    if (delivery.queue[i].session == 0)
+      continue;
+    outstanding++;
+    if (delivery.queue[i].session == session)
+      to_session++;
+  }
+
+  return outstanding < DD_NOTIFICATIONS_OUTSTANDING_MAX &&
+         to_session < DD_NOTIFICATIONS_NSTART;
+}
+
+/*
+ * start tracking confirmable notification, see dd_delivery_available
+ */
+static dd_outstanding_notification *
+dd_delivery_track(coap_session_t *session, coap_tid_t tid, time_t now) {
+  assert(session != 0);
+
+  for (size_t i = 0; i < DD_NOTIFICATIONS_OUTSTANDING_MAX; i++) {
+    dd_outstanding_notification *entry = &delivery.queue[i];
+    if (entry->session == 0) {
+      bzero(entry, sizeof(dd_outstanding_notification));
+      entry->session = session;
+      entry->tid = tid;
+      entry->sent = now;
+      return entry;
+    }
+  }
+
+  // checked by dd_delivery_available
+  assert(0);
+  return 0;
+}
+
+/*
+ * stop tracking notification, retrying its bindings unless acknowledged
+ */
+static void dd_delivery_settle(dd_outstanding_notification *entry,
+                               bool acknowledged, time_t now) {
+  assert(entry != 0);
+
+  for (size_t bid = 0; bid <= UINT8_MAX; bid++) {
+    if ((entry->bindings[bid / 8] & (1 << (bid % 8))) == 0)
+      continue;
+
+    if (acknowledged) {
+      delivery.stats.acknowledged++;
+      delivery.retries[bid] = 0;
+      continue;
+    }
+
+    // values were not delivered, report regardless of changes
+    binding_states[bid].rid = 0;
+    if (delivery.retries[bid] < DD_NOTIFICATION_RETRIES_MAX) {
+      delivery.stats.retried++;
+      delivery.retries[bid]++;
+      dd_reschedule_binding(bid, now + (DD_NOTIFICATION_BACKOFF
+                                        << (delivery.retries[bid] - 1)));
+    } else {
+      // give up, report when due next
+      delivery.stats.dropped++;
+      delivery.retries[bid] = 0;
+    }
+  }
+  entry->session = 0;
+}
+
+static dd_outstanding_notification *dd_delivery_find(coap_session_t *session,
+                                                     coap_tid_t tid) {
+  for (size_t i = 0; i < DD_NOTIFICATIONS_OUTSTANDING_MAX; i++) {
+    dd_outstanding_notification *entry = &delivery.queue[i];
+    if (entry->session == session && entry->tid == tid)
+      return entry;
+  }
+
+  // not a notification, or settled already
+  return 0;
+}
+
+void dd_handle_notification_response(coap_context_t *context,
+                                     coap_session_t *session, coap_pdu_t *sent,
+                                     coap_pdu_t *received,
+                                     const coap_tid_t id) {
+  dd_outstanding_notification *entry = dd_delivery_find(session, id);
+  if (entry != 0)
+    dd_delivery_settle(entry, true, time(0));
+}
+
+void dd_handle_notification_nack(coap_context_t *context,
+                                 coap_session_t *session, coap_pdu_t *sent,
+                                 coap_nack_reason_t reason,
+                                 const coap_tid_t id) {
+  dd_outstanding_notification *entry = dd_delivery_find(session, id);
+  if (entry != 0)
+    dd_delivery_settle(entry, false, time(0));
 }
 
 /*
  * Periodic Jobs
  */
-static void dd_make_notification(QCBOREncodeContext *ctx, dd_endpoint *endpoint,
-                                 dd_cluster *cluster, dd_binding *binding,
-                                 dd_report *report, int force) {
+static void dd_make_notification(QCBOREncodeContext *ctx, dd_cluster *cluster,
+                                 dd_binding *binding,
+                                 dd_binding_envelope *envelope,
+                                 dd_report_sample *sample) {
   assert(cluster != 0);
   assert(binding != 0);
-  assert(report != 0);
+  assert(envelope != 0);
+  assert(sample != 0);
+  dd_report *report = sample->report;
   time_t now = time(0);
 
   // encode notification as cbor map
   QCBOREncode_OpenMap(ctx);
+  if (sample->attributes.ptr != 0) {
+    // attribute map shared by bindings of report, only envelope is per binding
+    QCBOREncode_AddEncodedToMap(ctx, "a", sample->attributes);
+    goto dd_make_notification__envelope;
+  }
   QCBOREncode_OpenMapInMap(ctx, "a");
-  for (dd_report_attribute *attribute_configuration = report->attributes;
-       attribute_configuration < report->attributes + report->attributes_length;
-       attribute_configuration +=
-       sizeof(dd_report_attribute) + attribute_configuration->length) {
-    // TODO: direct link from configuration to attribute instance
-    dd_attribute *attribute = 0;
-    for (size_t j = 0; j < cluster->attributes_length; j++) {
-      if (cluster->attributes[j]->id == attribute_configuration->aid) {
-        attribute = cluster->attributes[j];
-        break;
-      }
-    }
+  size_t i = 0;
+  for (dd_report_attribute *attribute_configuration =
+           dd_report_attribute_next(report, 0);
+       attribute_configuration != 0;
+       attribute_configuration =
+           dd_report_attribute_next(report, attribute_configuration), i++) {
+    dd_attribute *attribute =
+        dd_report_attribute_link(cluster, report, i, attribute_configuration);
     assert(attribute != 0);
 
-    // TODO: conditional based on change, min and max ...
     char buffer[1024]; // TODO: use meaningful estimate
-    dd_cbor_add_value_keyn(ctx, attribute->id,
-                           attribute->read(buffer, sizeof(buffer)));
+    dd_value *value = dd_attribute_read(attribute, buffer, sizeof(buffer));
+    if (value != 0)
+      dd_cbor_add_value_keyn(ctx, attribute->id, value);
   }
   QCBOREncode_CloseMap(ctx);
+
+dd_make_notification__envelope:
   QCBOREncode_AddUInt64ToMap(ctx, "b", binding->id);
   QCBOREncode_AddUInt64ToMap(ctx, "r", report->id);
   QCBOREncode_AddDateEpochToMap(ctx, "t", now);
-  { // build sender uri
-    char sender_uri_buffer[1024];
-    dd_uri *sender_uri = (void *)sender_uri_buffer;
-    bzero(sender_uri, sizeof(dd_uri));
-    sender_uri->host = sender_uri->_buffer + sender_uri->length;
-    memcpy((void *)sender_uri->host, "localhost", sizeof("localhost"));
-    sender_uri->length += sizeof("localhost"); // TODO: real hostname
-    sender_uri->path = sender_uri->_buffer + sender_uri->length;
-    sender_uri->length += snprintf(
-        (void *)sender_uri->path,
-        sizeof(sender_uri_buffer) - sizeof(dd_uri) - sender_uri->length,
-        "/zcl/e/%x/%c%x", endpoint->id, cluster->role, cluster->id);
-    dd_cbor_add_uri_key(ctx, "u", sender_uri);
-  }
+  QCBOREncode_AddEncodedToMap(ctx, "u", envelope->sender);
   QCBOREncode_CloseMap(ctx);
 }
 
-int32_t dd_process_bindings(coap_context_t *context, dd_device *device) {
+/*
+ * notification due in current tick, see dd_process_bindings
+ */
+struct dd_pending_notification {
+  dd_endpoint *endpoint;
+  dd_cluster *cluster;
+  dd_binding *binding;
+  dd_binding_envelope *envelope;
+  dd_report_sample *sample;
+  bool done;
+};
+typedef struct dd_pending_notification dd_pending_notification;
+
+static dd_pending_notification pending_notifications[UINT8_MAX];
+
+// coap header, content-format and size1 options, payload marker; uri-path
+// options are added on top
+#define DD_NOTIFICATION_OVERHEAD 16
+
+/*
+ * encode single notification into buffer
+ *
+ * returns:
+ * - NULLUsefulBufC if buffer is too small
+ */
+static UsefulBufC dd_encode_notification(UsefulBuf buffer,
+                                         dd_pending_notification *pending) {
+  assert(pending != 0);
+  QCBOREncodeContext cec;
+  UsefulBufC result = NULLUsefulBufC;
+
+  QCBOREncode_Init(&cec, buffer);
+  dd_make_notification(&cec, pending->cluster, pending->binding,
+                       pending->envelope, pending->sample);
+  if (QCBOREncode_Finish(&cec, &result) != QCBOR_SUCCESS)
+    return NULLUsefulBufC;
+  return result;
+}
+
+int32_t dd_process_bindings(coap_context_t *context, dd_device *device,
+                            bool batch) {
   assert(device != 0);
-  uint16_t maysleep = UINT16_MAX;
   time_t now = time(0);
   QCBOREncodeContext cec;
   UsefulBuf_MAKE_STACK_UB(request_buffer,
                           1024); // TODO: estimate meaningful size
+  UsefulBuf_MAKE_STACK_UB(notification_buffer, 1024);
+  UsefulBuf_MAKE_STACK_UB(entry_buffer, 1024);
   UsefulBufC request_result = NULLUsefulBufC;
+  size_t pending_length = 0;
+  dd_endpoint *endpoint;
+  dd_cluster *cluster;
+  dd_binding *binding;
+
+  // sample each report at most once per tick
+  tick.samples_length = 0;
+  tick.arena_length = 0;
+
+  // give up on confirmable notifications neither acknowledged nor nacked
+  // past libcoap retransmissions, e.g. when their session was released
+  for (size_t i = 0; i < DD_NOTIFICATIONS_OUTSTANDING_MAX; i++) {
+    dd_outstanding_notification *entry = &delivery.queue[i];
+    if (entry->session != 0 &&
+        difftime(now, entry->sent) > DD_NOTIFICATION_ACK_TIMEOUT)
+      dd_delivery_settle(entry, false, now);
+  }
+
+  // visit due bindings only, earliest first
+  while ((binding = dd_schedule_next(now, &endpoint, &cluster)) != 0) {
+    dd_report *report = dd_binding_report(binding);
+    assert(report != 0); // bindings without report are not scheduled
+    dd_report_sample *sample = dd_sample_report(cluster, report);
+
+    // minimum interval elapsed: report changes, or heartbeat at maximum
+    uint16_t max = report->max_reporting_interval;
+    time_t last = dd_schedule_last(binding);
+    bool heartbeat = max != 0 && difftime(now, last) >= max;
+    dd_binding_envelope *envelope =
+        dd_make_envelope(endpoint, cluster, binding);
+    if (envelope == 0)
+      fprintf(stderr, "binding destination exceeds envelope!\n");
+    if (envelope == 0 ||
+        (!heartbeat && !dd_report_changed(cluster, binding, sample))) {
+      // nothing worth reporting (or no way to), sample again after minimum
+      // interval but no later than heartbeat
+      uint16_t min = report->min_reporting_interval;
+      time_t due = now + (min > 0 ? min : 1);
+      if (max != 0 && last + max < due)
+        due = last + max;
+      dd_schedule_binding_at(endpoint, cluster, binding, due);
+      continue;
+    }
 
-  for (int i = 0; i < device->endpoints_length; i++) {
-    dd_endpoint *endpoint = device->endpoints[i];
-    for (int j = 0; j < endpoint->cluster_length; j++) {
-      dd_cluster *cluster = endpoint->cluster[j];
-      for (int k = 0; k < cluster->bindings_length; k++) {
-        dd_binding *binding = cluster->bindings[k];
-        // TODO: direct link from binding to report ...
-        dd_report *report = 0;
-        for (int l = 0; l < cluster->reports_length; l++) {
-          report = cluster->reports[l];
-          if (report->id == binding->rid) {
-            break;
-          }
-        }
-        if (binding->rid == 0) {
-          // TODO: support a default report configuration
-          fprintf(stderr, "TODO: support default report configuration\n");
+    // notify below, together with others due for same destination
+    assert(pending_length < UINT8_MAX);
+    pending_notifications[pending_length++] = (dd_pending_notification){
+        endpoint, cluster, binding, envelope, sample, false};
+  }
+
+  for (size_t i = 0; i < pending_length; i++) {
+    dd_pending_notification *pending = &pending_notifications[i];
+    if (pending->done)
+      continue;
+    binding = pending->binding;
+
+    // notifications packed into this message, by index
+    uint8_t packed[UINT8_MAX];
+    size_t packed_length = 0;
+    packed[packed_length++] = i;
+    pending->done = true;
+    bool sent = false;
+    dd_outstanding_notification *outstanding = 0; // if confirmable
+
+    // get pooled client session
+    coap_session_t *session;
+    int ret = dd_coap_session(&session, context, dd_binding_uri(binding), now);
+    if (ret == 1) {
+      // destination still resolving, keep binding pending
+      dd_schedule_binding_at(pending->endpoint, pending->cluster, binding,
+                             now + 1);
+      continue;
+    }
+    if (ret != 0) {
+      fprintf(stderr, "failed to create client session!\n");
+      goto dd_process_bindings__reschedule;
+    }
+    if (binding->confirmable && !dd_delivery_available(session)) {
+      // destination busy, keep binding pending rather than queue up
+      delivery.stats.deferred++;
+      dd_schedule_binding_at(pending->endpoint, pending->cluster, binding,
+                             now + 1);
+      continue;
+    }
+
+    printf("sending report by time\n");
+    // build notification
+    request_result = dd_encode_notification(notification_buffer, pending);
+    assert(request_result.ptr != 0);
+
+    if (batch) {
+      // pack notifications due for same destination as cbor array, as many
+      // as fit into one message
+      size_t limit = coap_session_max_pdu_size(session);
+      size_t overhead =
+          DD_NOTIFICATION_OVERHEAD + pending->envelope->path_length;
+      limit = limit > overhead ? limit - overhead : 0;
+      if (limit > request_buffer.len)
+        limit = request_buffer.len;
+      size_t length = 3 + request_result.len; // array header up to 3 bytes
+
+      QCBOREncode_Init(&cec, request_buffer);
+      QCBOREncode_OpenArray(&cec);
+      QCBOREncode_AddEncoded(&cec, request_result);
+      for (size_t j = i + 1; j < pending_length; j++) {
+        dd_pending_notification *candidate = &pending_notifications[j];
+        if (candidate->done ||
+            candidate->binding->confirmable != binding->confirmable ||
+            !dd_uri_equals(dd_binding_uri(candidate->binding),
+                           dd_binding_uri(binding)))
           continue;
-        }
-        assert(report != 0 && report->id == binding->rid);
-
-        // calculate time report is due
-        double elapsed = difftime(now, binding->timestamp);
-        uint16_t slack =
-            report->max_reporting_interval - report->min_reporting_interval;
-
-        // TODO: pick random time within min and max
-        if (elapsed >= report->min_reporting_interval) {
-          printf("sending report by time\n");
-          // build notification
-          QCBOREncode_Init(&cec, request_buffer);
-          dd_make_notification(&cec, endpoint, cluster, binding, report, 1);
-          QCBORError ceerr = QCBOREncode_Finish(&cec, &request_result);
-          assert(ceerr == QCBOR_SUCCESS);
-
-          // create client session
-          coap_address_t addr;
-          dd_coap_resolve(&addr, binding->uri->host, binding->uri->port);
-          coap_session_t *session =
-              coap_new_client_session(context, 0, &addr, COAP_PROTO_UDP);
-          if (session == 0) {
-            fprintf(stderr, "failed to create client session!\n");
-            continue;
-          }
 
-          // send
-          coap_pdu_t *notification = coap_pdu_init(
-              COAP_MESSAGE_NON, COAP_REQUEST_POST, coap_new_message_id(session),
-              coap_session_max_pdu_size(session));
-          if (notification == 0) {
-            fprintf(stderr, "Failed to create new coap message!\n");
-            continue;
-          }
-          uint8_t optbuffer[4];
-          coap_add_option(notification, COAP_OPTION_URI_PATH,
-                          strlen(binding->uri->path) + 1,
-                          (const uint8_t *)binding->uri->path);
-          coap_add_option(notification, COAP_OPTION_CONTENT_TYPE,
-                          coap_encode_var_safe(optbuffer, sizeof(optbuffer),
-                                               COAP_MEDIATYPE_APPLICATION_CBOR),
-                          optbuffer);
-          coap_add_option(notification, COAP_OPTION_SIZE1,
-                          coap_encode_var_safe(optbuffer, sizeof(optbuffer),
-                                               request_result.len),
-                          optbuffer);
-          coap_add_data(notification, request_result.len, request_result.ptr);
-          // TODO: many magic numbers here, document ...
-
-          coap_send(session, notification);
-          coap_session_release(session);
-
-          // remember
-          binding->timestamp = now;
-          elapsed = 0.0f;
-          dd_storage_bindings_update(binding, binding);
-          // TODO: also update pointer in resource tree ... ?
+        UsefulBufC entry = dd_encode_notification(entry_buffer, candidate);
+        if (entry.ptr == 0 || length + entry.len > limit) {
+          // does not fit, goes into a message of its own
+          continue;
         }
+        QCBOREncode_AddEncoded(&cec, entry);
+        length += entry.len;
+        packed[packed_length++] = j;
+        candidate->done = true;
+      }
+      QCBOREncode_CloseArray(&cec);
+
+      // a single notification is sent as is, understood by any receiver
+      if (packed_length > 1) {
+        QCBORError ceerr = QCBOREncode_Finish(&cec, &request_result);
+        assert(ceerr == QCBOR_SUCCESS);
+      }
+    }
+
+    // send
+    coap_pdu_t *notification = coap_pdu_init(
+        binding->confirmable ? COAP_MESSAGE_CON : COAP_MESSAGE_NON,
+        COAP_REQUEST_POST, coap_new_message_id(session),
+        coap_session_max_pdu_size(session));
+    if (notification == 0) {
+      fprintf(stderr, "Failed to create new coap message!\n");
+      goto dd_process_bindings__reschedule;
+    }
+    dd_binding_envelope *envelope = pending->envelope;
+    const uint8_t *option = envelope->path;
+    for (int k = 0; k < envelope->path_segments; k++) {
+      coap_add_option(notification, COAP_OPTION_URI_PATH,
+                      coap_opt_length(option), coap_opt_value(option));
+      option += coap_opt_size(option);
+    }
+    coap_add_option(notification, COAP_OPTION_CONTENT_TYPE,
+                    envelope->content_format_length, envelope->content_format);
+    uint8_t optbuffer[4];
+    coap_add_option(notification, COAP_OPTION_SIZE1,
+                    coap_encode_var_safe(optbuffer, sizeof(optbuffer),
+                                         request_result.len),
+                    optbuffer);
+    coap_add_data(notification, request_result.len, request_result.ptr);
+    // TODO: many magic numbers here, document ...
+
+    coap_tid_t tid = coap_send(session, notification);
+    if (tid == COAP_INVALID_TID) {
+      // start over with a new session next time
+      dd_coap_session_failed(session);
+    } else {
+      sent = true;
+      delivery.stats.sent += packed_length;
+      if (binding->confirmable)
+        outstanding = dd_delivery_track(session, tid, now);
+    }
 
-        // note time till due next
-        if (report->min_reporting_interval - elapsed < maysleep)
-          maysleep = report->min_reporting_interval - elapsed;
+  dd_process_bindings__reschedule:
+    for (size_t k = 0; k < packed_length; k++) {
+      dd_pending_notification *notified = &pending_notifications[packed[k]];
+      if (sent)
+        dd_report_remember(notified->cluster, notified->binding,
+                           notified->sample);
+
+      // remember, failed notifications are retried next interval
+      dd_schedule_notified(notified->endpoint, notified->cluster,
+                           notified->binding, now);
+      if (outstanding != 0) {
+        uint8_t bid = notified->binding->id;
+        outstanding->bindings[bid / 8] |= 1 << (bid % 8);
       }
     }
   }
 
-  return maysleep;
+  // close sessions no longer in use
+  dd_coap_sessions_expire(now);
+
+  // persist notification times now and then
+  dd_schedule_checkpoint(now, false);
+
+  // time till due next
+  return dd_schedule_timeout(now);
 }
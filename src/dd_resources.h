@@ -195,10 +195,57 @@ void dd_handle_report_delete(dd_device *device, dd_endpoint *endpoint,
                              coap_binary_t *token, coap_string_t *query,
                              coap_pdu_t *response);
 
+/*
+ * Notification Delivery
+ *
+ * Confirmable notifications are tracked until acknowledged, at most
+ * DD_NOTIFICATIONS_NSTART per destination and
+ * DD_NOTIFICATIONS_OUTSTANDING_MAX in total; bindings due meanwhile are
+ * deferred. libcoap retransmits them until acknowledged or it gives up,
+ * after at most MAX_TRANSMIT_WAIT (93 seconds by default); only then are
+ * bindings not acknowledged notified again with current values, in a new
+ * exchange after a backoff of DD_NOTIFICATION_BACKOFF seconds, doubled per
+ * retry, and dropped after DD_NOTIFICATION_RETRIES_MAX retries.
+ */
+#define DD_NOTIFICATIONS_OUTSTANDING_MAX 16
+#define DD_NOTIFICATIONS_NSTART 1 // RFC 7252 section 4.7
+#define DD_NOTIFICATION_RETRIES_MAX 4
+#define DD_NOTIFICATION_BACKOFF 2
+#define DD_NOTIFICATION_ACK_TIMEOUT 100 // > MAX_TRANSMIT_WAIT, lost nack
+
+// counters by notification, i.e. binding, not message
+struct dd_notification_stats {
+  uint32_t sent;         // passed to libcoap
+  uint32_t acknowledged; // confirmable, acknowledged
+  uint32_t retried;      // confirmable, not acknowledged and retried
+  uint32_t dropped;      // confirmable, not acknowledged after retries
+  uint32_t deferred;     // confirmable, destination busy
+};
+typedef struct dd_notification_stats dd_notification_stats;
+
+const dd_notification_stats *dd_get_notification_stats();
+
+// libcoap response and nack handlers, for client sessions
+void dd_handle_notification_response(coap_context_t *context,
+                                     coap_session_t *session, coap_pdu_t *sent,
+                                     coap_pdu_t *received, const coap_tid_t id);
+void dd_handle_notification_nack(coap_context_t *context,
+                                 coap_session_t *session, coap_pdu_t *sent,
+                                 coap_nack_reason_t reason,
+                                 const coap_tid_t id);
+
 /*
  * Periodic Jobs
  */
-int32_t dd_process_bindings(coap_context_t *context, dd_device *device);
+
+/*
+ * send notifications for due bindings, with batch packing those for same
+ * destination into one message
+ *
+ * returns time in seconds until next binding is due
+ */
+int32_t dd_process_bindings(coap_context_t *context, dd_device *device,
+                            bool batch);
 
 /*
  * Shortcuts
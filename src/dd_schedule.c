@@ -0,0 +1,353 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+#include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "dd_schedule.h"
+#include "dd_storage.h"
+#include "dd_types.h"
+
+struct dd_schedule_entry {
+  time_t due;
+  dd_endpoint *endpoint;
+  dd_cluster *cluster;
+  dd_binding *binding;
+};
+typedef struct dd_schedule_entry dd_schedule_entry;
+
+/*
+ * min-heap of scheduled bindings, earliest due at index 0
+ *
+ * Note: binding ids are unique uint8 (derived from storage index), position
+ * maps them to heap index + 1, 0 meaning not scheduled.
+ */
+static struct {
+  dd_schedule_entry heap[UINT8_MAX];
+  size_t length;
+  size_t position[UINT8_MAX + 1];
+} schedule;
+
+/*
+ * volatile time of last notification, by binding id
+ *
+ * Note: persisted binding timestamps are only written on checkpoint, dirty
+ * holds bindings notified since.
+ */
+static struct {
+  time_t last[UINT8_MAX + 1];
+  dd_binding *dirty[UINT8_MAX + 1];
+  uint32_t interval;
+  time_t checkpoint;
+} notified = {.interval = 3600};
+
+/*
+ * report jitter, offsets deadlines of bindings into their [min, max] window
+ *
+ * Note: offsets are kept per binding id, so that a binding keeps its phase
+ * from one notification to the next.
+ */
+static struct {
+  uint8_t percent;
+  bool spread;
+  unsigned int seed;
+  bool assigned[UINT8_MAX + 1];
+  uint16_t offset[UINT8_MAX + 1];
+} jitter;
+
+static void dd_schedule_swap(size_t a, size_t b) {
+  dd_schedule_entry tmp = schedule.heap[a];
+  schedule.heap[a] = schedule.heap[b];
+  schedule.heap[b] = tmp;
+  schedule.position[schedule.heap[a].binding->id] = a + 1;
+  schedule.position[schedule.heap[b].binding->id] = b + 1;
+}
+
+static void dd_schedule_sift_up(size_t index) {
+  while (index > 0) {
+    size_t parent = (index - 1) / 2;
+    if (schedule.heap[parent].due <= schedule.heap[index].due)
+      break;
+    dd_schedule_swap(parent, index);
+    index = parent;
+  }
+}
+
+static void dd_schedule_sift_down(size_t index) {
+  for (;;) {
+    size_t smallest = index;
+    size_t left = 2 * index + 1;
+    size_t right = 2 * index + 2;
+    if (left < schedule.length &&
+        schedule.heap[left].due < schedule.heap[smallest].due)
+      smallest = left;
+    if (right < schedule.length &&
+        schedule.heap[right].due < schedule.heap[smallest].due)
+      smallest = right;
+    if (smallest == index)
+      break;
+    dd_schedule_swap(index, smallest);
+    index = smallest;
+  }
+}
+
+/*
+ * remove heap entry at index
+ */
+static void dd_schedule_remove(size_t index) {
+  assert(index < schedule.length);
+
+  schedule.position[schedule.heap[index].binding->id] = 0;
+  schedule.length--;
+  if (index == schedule.length) {
+    // was last entry
+    return;
+  }
+
+  // move last entry into the gap and restore order
+  schedule.heap[index] = schedule.heap[schedule.length];
+  schedule.position[schedule.heap[index].binding->id] = index + 1;
+  dd_schedule_sift_up(index);
+  dd_schedule_sift_down(index);
+}
+
+/*
+ * size of window jitter offsets are picked from
+ */
+static uint16_t dd_schedule_jitter_window(const dd_report *report) {
+  assert(report != 0);
+
+  if (report->max_reporting_interval <= report->min_reporting_interval) {
+    // no heartbeat, or no room between min and max
+    return 0;
+  }
+
+  uint32_t window =
+      report->max_reporting_interval - report->min_reporting_interval;
+  return window * jitter.percent / 100;
+}
+
+void dd_schedule_set_jitter(uint8_t percent, bool spread, uint32_t seed) {
+  jitter.percent = percent > 100 ? 100 : percent;
+  jitter.spread = spread;
+  jitter.seed = seed != 0 ? seed : (unsigned int)time(0) ^ (getpid() << 16);
+}
+
+void dd_schedule_init(dd_device *device) {
+  assert(device != 0);
+  time_t now = time(0);
+  notified.checkpoint = now;
+
+  // count bindings, for spreading them evenly
+  size_t count = 0;
+  for (size_t i = 0; i < device->endpoints_length; i++) {
+    dd_endpoint *endpoint = device->endpoints[i];
+    for (size_t j = 0; j < endpoint->cluster_length; j++)
+      count += endpoint->cluster[j]->bindings_length;
+  }
+  // random phase, so that nodes with same configuration do not align
+  size_t slot = count > 0 ? rand_r(&jitter.seed) % count : 0;
+
+  for (size_t i = 0; i < device->endpoints_length; i++) {
+    dd_endpoint *endpoint = device->endpoints[i];
+    for (size_t j = 0; j < endpoint->cluster_length; j++) {
+      dd_cluster *cluster = endpoint->cluster[j];
+      for (size_t k = 0; k < cluster->bindings_length; k++) {
+        dd_binding *binding = cluster->bindings[k];
+        dd_report *report = dd_binding_report(binding);
+        if (jitter.spread && report != 0) {
+          // give each binding its own slot of the window
+          jitter.offset[binding->id] =
+              (uint32_t)dd_schedule_jitter_window(report) * slot / count;
+          jitter.assigned[binding->id] = true;
+          slot = (slot + 1) % count;
+        }
+        dd_schedule_binding(endpoint, cluster, binding);
+
+        size_t position = schedule.position[binding->id];
+        if (position != 0 && schedule.heap[position - 1].due < now) {
+          // overdue since before startup, e.g. after power loss:
+          // don't notify all at once but at offset from now
+          dd_schedule_binding_at(endpoint, cluster, binding,
+                                 now + jitter.offset[binding->id]);
+        }
+      }
+    }
+  }
+}
+
+/*
+ * schedule binding relative to its last notification
+ */
+static void dd_schedule_after_last(dd_endpoint *endpoint, dd_cluster *cluster,
+                                   dd_binding *binding) {
+  assert(endpoint != 0);
+  assert(cluster != 0);
+  assert(binding != 0);
+  time_t last = notified.last[binding->id];
+
+  dd_report *report = dd_binding_report(binding);
+  if (report == 0) {
+    // TODO: support a default report configuration
+    dd_unschedule_binding(binding);
+    return;
+  }
+  if (report->max_reporting_interval == UINT16_MAX) {
+    // reporting disabled
+    dd_unschedule_binding(binding);
+    return;
+  }
+
+  if (!jitter.assigned[binding->id]) {
+    // pick random offset within [min, max] once
+    uint16_t window = dd_schedule_jitter_window(report);
+    jitter.offset[binding->id] =
+        window > 0 ? rand_r(&jitter.seed) % (window + 1) : 0;
+    jitter.assigned[binding->id] = true;
+  }
+
+  // due once minimum interval (plus jitter) elapsed since last notification
+  // Note: at most one notification per second, even for 0 minimum
+  time_t due =
+      last + report->min_reporting_interval + jitter.offset[binding->id];
+  if (due <= last)
+    due = last + 1;
+
+  dd_schedule_binding_at(endpoint, cluster, binding, due);
+}
+
+void dd_schedule_binding(dd_endpoint *endpoint, dd_cluster *cluster,
+                         dd_binding *binding) {
+  assert(binding != 0);
+
+  // start over from persisted state
+  notified.last[binding->id] = binding->timestamp;
+  dd_schedule_after_last(endpoint, cluster, binding);
+}
+
+void dd_schedule_notified(dd_endpoint *endpoint, dd_cluster *cluster,
+                          dd_binding *binding, time_t now) {
+  assert(binding != 0);
+
+  notified.last[binding->id] = now;
+  notified.dirty[binding->id] = binding;
+  dd_schedule_after_last(endpoint, cluster, binding);
+}
+
+time_t dd_schedule_last(dd_binding *binding) {
+  assert(binding != 0);
+
+  return notified.last[binding->id];
+}
+
+void dd_schedule_set_checkpoint_interval(uint32_t interval) {
+  notified.interval = interval;
+}
+
+void dd_schedule_checkpoint(time_t now, bool force) {
+  if (!force && difftime(now, notified.checkpoint) < notified.interval) {
+    // not due yet
+    return;
+  }
+
+  for (size_t id = 0; id <= UINT8_MAX; id++) {
+    if (notified.dirty[id] != 0) {
+      dd_storage_bindings_touch(notified.dirty[id], notified.last[id]);
+      notified.dirty[id] = 0;
+    }
+  }
+  // one sync for all of them
+  dd_storage_commit();
+  notified.checkpoint = now;
+}
+
+void dd_schedule_binding_at(dd_endpoint *endpoint, dd_cluster *cluster,
+                            dd_binding *binding, time_t due) {
+  assert(endpoint != 0);
+  assert(cluster != 0);
+  assert(binding != 0);
+  assert(binding->id != 0);
+
+  size_t position = schedule.position[binding->id];
+  if (position == 0) {
+    // append new entry
+    assert(schedule.length < UINT8_MAX);
+    position = ++schedule.length;
+    schedule.position[binding->id] = position;
+  }
+
+  dd_schedule_entry *entry = &schedule.heap[position - 1];
+  entry->due = due;
+  entry->endpoint = endpoint;
+  entry->cluster = cluster;
+  entry->binding = binding;
+  dd_schedule_sift_up(position - 1);
+  dd_schedule_sift_down(schedule.position[binding->id] - 1);
+}
+
+void dd_reschedule_binding(uint8_t bid, time_t due) {
+  size_t position = schedule.position[bid];
+  if (position == 0) {
+    // not scheduled, e.g. deleted
+    return;
+  }
+
+  schedule.heap[position - 1].due = due;
+  dd_schedule_sift_up(position - 1);
+  dd_schedule_sift_down(schedule.position[bid] - 1);
+}
+
+void dd_unschedule_binding(dd_binding *binding) {
+  assert(binding != 0);
+
+  // pick new offset when scheduled again, report may have changed
+  jitter.assigned[binding->id] = false;
+  // binding deleted or reconfigured, drop its volatile state
+  notified.dirty[binding->id] = 0;
+
+  size_t position = schedule.position[binding->id];
+  if (position != 0)
+    dd_schedule_remove(position - 1);
+}
+
+dd_binding *dd_schedule_next(time_t now, dd_endpoint **endpoint,
+                             dd_cluster **cluster) {
+  assert(endpoint != 0);
+  assert(cluster != 0);
+
+  if (schedule.length == 0 || schedule.heap[0].due > now) {
+    // nothing due
+    return 0;
+  }
+
+  dd_binding *binding = schedule.heap[0].binding;
+  *endpoint = schedule.heap[0].endpoint;
+  *cluster = schedule.heap[0].cluster;
+  dd_schedule_remove(0);
+  return binding;
+}
+
+int32_t dd_schedule_timeout(time_t now) {
+  if (schedule.length == 0) {
+    // nothing scheduled
+    return UINT16_MAX;
+  }
+
+  double remaining = difftime(schedule.heap[0].due, now);
+  double checkpoint = difftime(notified.checkpoint + notified.interval, now);
+  if (checkpoint < remaining) {
+    // wake up for checkpoint, if anything is to be written
+    for (size_t id = 0; id <= UINT8_MAX; id++) {
+      if (notified.dirty[id] != 0) {
+        remaining = checkpoint;
+        break;
+      }
+    }
+  }
+  if (remaining <= 0)
+    return 0;
+  if (remaining > UINT16_MAX)
+    return UINT16_MAX;
+  return remaining;
+}
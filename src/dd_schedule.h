@@ -0,0 +1,110 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+#ifndef HAVE_DDSCHEDULE_H
+#define HAVE_DDSCHEDULE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+struct dd_binding;
+typedef struct dd_binding dd_binding;
+struct dd_cluster;
+typedef struct dd_cluster dd_cluster;
+struct dd_device;
+typedef struct dd_device dd_device;
+struct dd_endpoint;
+typedef struct dd_endpoint dd_endpoint;
+
+/*
+ * Binding Scheduler
+ *
+ * Keeps bindings in a min-heap ordered by the time their next notification is
+ * due, so that only due bindings are visited.
+ */
+
+/*
+ * configure report jitter, applies to bindings scheduled afterwards
+ *
+ * Each binding is offset by up to percent of the window between its minimum
+ * and maximum reporting interval. With spread, bindings scheduled at init
+ * divide the window evenly instead of picking random offsets.
+ * A seed of 0 picks one from time and process id.
+ */
+void dd_schedule_set_jitter(uint8_t percent, bool spread, uint32_t seed);
+
+/*
+ * schedule all bindings linked into resource tree
+ *
+ * Note: bindings overdue since before startup are due at their jitter offset
+ * from now.
+ */
+void dd_schedule_init(dd_device *device);
+
+/*
+ * (re-)schedule binding after it was created, updated or notified
+ *
+ * Note: bindings without report configuration are unscheduled.
+ */
+void dd_schedule_binding(dd_endpoint *endpoint, dd_cluster *cluster,
+                         dd_binding *binding);
+
+/*
+ * re-schedule binding after it was notified at now
+ *
+ * Note: time of notification is kept volatile until next checkpoint.
+ */
+void dd_schedule_notified(dd_endpoint *endpoint, dd_cluster *cluster,
+                          dd_binding *binding, time_t now);
+
+/*
+ * returns time of last notification of binding
+ */
+time_t dd_schedule_last(dd_binding *binding);
+
+/*
+ * (re-)schedule binding at given time, e.g. to retry a deferred notification
+ */
+void dd_schedule_binding_at(dd_endpoint *endpoint, dd_cluster *cluster,
+                            dd_binding *binding, time_t due);
+
+/*
+ * move binding by id to given time, if scheduled
+ *
+ * Note: for callers only holding the binding id, e.g. delivery callbacks.
+ */
+void dd_reschedule_binding(uint8_t bid, time_t due);
+
+/*
+ * remove binding from schedule, if scheduled
+ */
+void dd_unschedule_binding(dd_binding *binding);
+
+/*
+ * remove next binding due at or before now from schedule
+ *
+ * returns:
+ * - 0 if no binding is due
+ */
+dd_binding *dd_schedule_next(time_t now, dd_endpoint **endpoint,
+                             dd_cluster **cluster);
+
+/*
+ * set seconds between checkpoints, 0 writes notification times every tick
+ */
+void dd_schedule_set_checkpoint_interval(uint32_t interval);
+
+/*
+ * write notification times to persisted bindings, if checkpoint interval
+ * elapsed or forced (e.g. at shutdown)
+ */
+void dd_schedule_checkpoint(time_t now, bool force);
+
+/*
+ * returns time in seconds until next binding or checkpoint is due;
+ * UINT16_MAX if none
+ */
+int32_t dd_schedule_timeout(time_t now);
+
+#endif /* HAVE_DDSCHEDULE_H */
@@ -2,6 +2,7 @@
  * License, v. 2.0. If a copy of the MPL was not distributed with this
  * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
 #include <assert.h>
+#include <stddef.h>
 
 #ifdef __linux__
 #include <errno.h>
@@ -9,6 +10,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <unistd.h>
 #endif
 
 #include "dd_storage.h"
@@ -18,22 +20,142 @@
  * Declare Tables
  */
 struct table {
-  void *base;
-  size_t length;
-  size_t rowsize;
+  uint8_t id;      // of table in journal records
+  void *base;      // start of address window, UINT8_MAX rows
+  size_t length;   // number of rows backed by file
+  size_t rowsize;  // bytes per row
+  size_t capacity; // number of rows table may grow to
+  struct table_header *header;
 };
 typedef struct table table;
-table bindings_table = {0};
-table reports_table = {0};
+table bindings_table = {.id = 0};
+table reports_table = {.id = 1};
 
 struct table_entry {
   uint8_t valid;
   uint8_t eid;
   uint16_t cid;
+  char role;
+  uint8_t _reserved[3];
+  uint32_t length;   // number of bytes of data in use
+  uint32_t checksum; // crc32 over entry (checksum 0) and data in use
   char data[];
 };
 typedef struct table_entry table_entry;
 
+/*
+ * Declare File Layout
+ *
+ * Note: the file starts with one page of header, followed by extents each
+ * table grows by. Extents of a table are mapped back to back, so that rows are
+ * contiguous in memory, however scattered in file. Records hold no absolute
+ * pointers (see dd_ref), so the file may be mapped at any address.
+ */
+#define DD_STORAGE_MAGIC 0x3164646f // "odd1"
+#define DD_STORAGE_VERSION 5
+#define DD_STORAGE_EXTENTS_MAX 16
+#define DD_STORAGE_BITMAP_WORDS ((UINT8_MAX + 63) / 64)
+
+struct table_extent {
+  uint32_t offset; // in file, page aligned
+  uint32_t size;   // in bytes, page aligned
+};
+typedef struct table_extent table_extent;
+
+struct table_header {
+  uint32_t rowsize;
+  uint32_t extents_length;
+  table_extent extents[DD_STORAGE_EXTENTS_MAX];
+  // rows in use, one bit per index
+  uint64_t used[DD_STORAGE_BITMAP_WORDS];
+};
+typedef struct table_header table_header;
+
+struct storage_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t pagesize;
+  uint32_t size; // number of bytes in use, end of last extent
+  table_header bindings;
+  table_header reports;
+};
+typedef struct storage_header storage_header;
+
+/*
+ * Configuration
+ */
+static struct {
+  const char *path;
+  size_t bindings_capacity;
+  size_t bindings_rowsize;
+  size_t reports_capacity;
+  size_t reports_rowsize;
+  dd_storage_durability bindings_durability;
+  dd_storage_durability reports_durability;
+} config = {
+    .path = "data.bin",
+    .bindings_capacity = UINT8_MAX,
+    .bindings_rowsize = 1024, // TODO: estimate reasonable row size
+    .reports_capacity = UINT8_MAX,
+    .reports_rowsize = 1024, // TODO: estimate reasonable row size
+    .bindings_durability = DD_STORAGE_SYNC,
+    .reports_durability = DD_STORAGE_SYNC,
+};
+
+void dd_storage_configure(const char *path, uint8_t bindings,
+                          uint16_t bindings_rowsize, uint8_t reports,
+                          uint16_t reports_rowsize) {
+  if (path != 0)
+    config.path = path;
+  if (bindings != 0)
+    config.bindings_capacity = bindings;
+  if (bindings_rowsize != 0)
+    config.bindings_rowsize = bindings_rowsize;
+  if (reports != 0)
+    config.reports_capacity = reports;
+  if (reports_rowsize != 0)
+    config.reports_rowsize = reports_rowsize;
+}
+
+void dd_storage_set_durability(dd_storage_durability bindings,
+                               dd_storage_durability reports) {
+  config.bindings_durability = bindings;
+  config.reports_durability = reports;
+}
+
+/*
+ * Row Allocation
+ *
+ * Note: a row is marked used before it is written and valid, and marked
+ * valid = 0 before it is released, so that a crash at worst leaks a row until
+ * the next dd_storage_init.
+ */
+
+static void dd_storage_mark(table *table, size_t index, bool used) {
+  assert(table != 0);
+  assert(index < DD_STORAGE_BITMAP_WORDS * 64);
+  uint64_t *word = &table->header->used[index / 64];
+
+  if (used)
+    *word |= (uint64_t)1 << (index % 64);
+  else
+    *word &= ~((uint64_t)1 << (index % 64));
+}
+
+/*
+ * returns index of first free row, at or beyond length if all are used
+ */
+static size_t dd_storage_first_free(table *table) {
+  assert(table != 0);
+
+  for (size_t i = 0; i < DD_STORAGE_BITMAP_WORDS; i++) {
+    uint64_t free = ~table->header->used[i];
+    if (free != 0)
+      return i * 64 + __builtin_ctzll(free);
+  }
+  return DD_STORAGE_BITMAP_WORDS * 64;
+}
+
 /*
  * Platform Implementations
  */
@@ -41,49 +163,621 @@ typedef struct table_entry table_entry;
 #ifdef __linux__
 /* File Backed Storage */
 static int fd = -1;
-static void *map_base_hint = (void *)0x12000000;
 static void *map_base = 0;
+static storage_header *header = 0;
+static size_t pagesize = 0;
+
+static size_t dd_storage_page_align(size_t size) {
+  assert(pagesize != 0);
+  return (size + pagesize - 1) / pagesize * pagesize;
+}
+
+/*
+ * size of address window reserved for a table, so that it never has to move
+ */
+static size_t dd_storage_window(size_t rowsize) {
+  return dd_storage_page_align(UINT8_MAX * rowsize);
+}
+
+/*
+ * number of bytes of file backing a table
+ */
+static size_t dd_storage_backed(table_header *layout) {
+  assert(layout != 0);
+
+  size_t size = 0;
+  for (size_t i = 0; i < layout->extents_length; i++)
+    size += layout->extents[i].size;
+  return size;
+}
+
+/*
+ * map extents of table into its window
+ *
+ * returns -1 on error
+ */
+static int dd_storage_map_table(table *table, void *base, size_t capacity,
+                                table_header *layout) {
+  assert(table != 0);
+  assert(layout != 0);
+
+  size_t size = 0;
+  for (size_t i = 0; i < layout->extents_length; i++) {
+    table_extent *extent = &layout->extents[i];
+    if (size + extent->size > dd_storage_window(layout->rowsize) ||
+        extent->offset + extent->size > header->size) {
+      // corrupt header
+      fprintf(stderr, "%s: invalid extent\n", config.path);
+      return -1;
+    }
+
+    void *address = mmap(base + size, extent->size, PROT_READ | PROT_WRITE,
+                         MAP_FIXED | MAP_SHARED, fd, extent->offset);
+    if (address == MAP_FAILED) {
+      // print error
+      perror(0);
+      return -1;
+    }
+    size += extent->size;
+  }
+
+  table->base = base;
+  table->rowsize = layout->rowsize;
+  table->capacity = capacity;
+  table->header = layout;
+  // Note: rows beyond capacity, e.g. after it was lowered, remain accessible
+  table->length = size / table->rowsize;
+  if (table->length > UINT8_MAX)
+    table->length = UINT8_MAX;
+  return 0;
+}
+
+/*
+ * append extent to table, doubling the rows backed by file
+ *
+ * Note: the extent is committed to the header only once file space is
+ * allocated and mapped, so that an interrupted growth leaves unused space.
+ *
+ * returns -1 if capacity is reached, or on error
+ */
+static int dd_storage_grow(table *table) {
+  assert(table != 0);
+  assert(table->header != 0);
+  table_header *layout = table->header;
+
+  if (table->length >= table->capacity) {
+    // capacity reached
+    return -1;
+  }
+  if (layout->extents_length >= DD_STORAGE_EXTENTS_MAX) {
+    // no room in header
+    fprintf(stderr, "%s: too many extents\n", config.path);
+    return -1;
+  }
+
+  // double backed space, at least one page, up to capacity
+  size_t backed = dd_storage_backed(layout);
+  size_t limit = dd_storage_page_align(table->capacity * table->rowsize);
+  size_t size = backed > 0 ? backed : pagesize;
+  if (backed + size > limit)
+    size = limit - backed;
+
+  // allocate file space
+  int ret = posix_fallocate(fd, header->size, size);
+  if (ret != 0) {
+    fprintf(stderr, "%s\n", strerror(ret));
+    return -1;
+  }
+
+  // map behind current extents
+  void *address = mmap(table->base + backed, size, PROT_READ | PROT_WRITE,
+                       MAP_FIXED | MAP_SHARED, fd, header->size);
+  if (address == MAP_FAILED) {
+    // print error
+    perror(0);
+    return -1;
+  }
+
+  // commit
+  table_extent *extent = &layout->extents[layout->extents_length];
+  extent->offset = header->size;
+  extent->size = size;
+  layout->extents_length++;
+  header->size += size;
+
+  table->length = (backed + size) / table->rowsize;
+  if (table->length > UINT8_MAX)
+    table->length = UINT8_MAX;
+
+  // persist extent before journal records may refer to its rows
+  if (msync(header, pagesize, MS_SYNC) != 0 || fdatasync(fd) != 0) {
+    // print error
+    perror(0);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Journal
+ *
+ * Mutations are appended to an in-memory buffer as after-images of whole rows,
+ * and applied to the mapping. dd_storage_commit writes the buffer to the
+ * journal file with one fdatasync for all of them (group commit). Mutations
+ * of tables configured DD_STORAGE_SYNC commit before they are applied.
+ *
+ * dd_storage_init replays complete records, then drops rows that fail their
+ * checksum, i.e. torn by a crash before their record was committed.
+ *
+ * Note: the mapping is shared, so a row applied before its record is
+ * committed may be written back, and torn, at any time. Dropping it is only
+ * harmless for new and deleted rows: updates commit first, unless a record of
+ * the row is in the journal file already to replay over a torn write. Deferred
+ * images, i.e. notification timestamps, are only applied once committed.
+ */
+#define DD_STORAGE_JOURNAL_MAGIC 0x6c6e726a // "jrnl"
+#define DD_STORAGE_JOURNAL_BUFFER (32 * 1024)
+// journal size at which data file is synced and journal truncated
+#define DD_STORAGE_JOURNAL_MAX (256 * 1024)
+
+struct journal_record {
+  uint32_t magic;
+  uint32_t checksum; // crc32 over record (checksum 0) and image
+  uint64_t sequence;
+  uint32_t length; // number of bytes of image
+  uint8_t table;   // see table.id
+  uint8_t _reserved;
+  uint16_t index;
+  char image[]; // table_entry and data
+};
+typedef struct journal_record journal_record;
+
+static struct {
+  int fd;
+  char path[256];
+  uint64_t sequence; // of next record
+  size_t size;       // number of bytes committed to file
+  size_t length;     // number of bytes pending in buffer
+  // rows with a committed record in file, by table id
+  uint64_t journaled[2][DD_STORAGE_BITMAP_WORDS];
+  uint64_t buffer[DD_STORAGE_JOURNAL_BUFFER / sizeof(uint64_t)];
+} journal = {.fd = -1};
+
+static size_t dd_storage_record_size(size_t length) {
+  // keep records, and images within, 8-byte aligned
+  return (sizeof(journal_record) + length + 7) & ~7;
+}
+
+static uint32_t dd_storage_crc32(const void *data, size_t length,
+                                 uint32_t crc) {
+  static uint32_t table[256];
+  if (table[1] == 0) {
+    // reflected polynomial of crc32 (ieee 802.3)
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++)
+        c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+      table[i] = c;
+    }
+  }
+
+  const uint8_t *bytes = data;
+  crc = ~crc;
+  for (size_t i = 0; i < length; i++)
+    crc = table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+static uint32_t dd_storage_entry_checksum(table_entry *entry) {
+  assert(entry != 0);
+
+  uint32_t checksum = entry->checksum;
+  entry->checksum = 0;
+  uint32_t result =
+      dd_storage_crc32(entry, sizeof(table_entry) + entry->length, 0);
+  entry->checksum = checksum;
+  return result;
+}
+
+/*
+ * sync data file, so that journal can be truncated
+ *
+ * returns -1 on error
+ */
+static int dd_storage_sync() {
+  table *tables[] = {&bindings_table, &reports_table};
+
+  if (msync(header, pagesize, MS_SYNC) != 0) {
+    // print error
+    perror(0);
+    return -1;
+  }
+  for (size_t i = 0; i < sizeof(tables) / sizeof(tables[0]); i++) {
+    size_t backed = dd_storage_backed(tables[i]->header);
+    if (backed != 0 && msync(tables[i]->base, backed, MS_SYNC) != 0) {
+      // print error
+      perror(0);
+      return -1;
+    }
+  }
+
+  if (ftruncate(journal.fd, 0) != 0 || fsync(journal.fd) != 0) {
+    // print error
+    perror(0);
+    return -1;
+  }
+  journal.size = 0;
+  bzero(journal.journaled, sizeof(journal.journaled));
+  return 0;
+}
+
+int dd_storage_commit() {
+  if (journal.length == 0) {
+    // nothing pending
+    return 0;
+  }
+
+  ssize_t written =
+      pwrite(journal.fd, journal.buffer, journal.length, journal.size);
+  if (written != journal.length || fdatasync(journal.fd) != 0) {
+    // print error, pending mutations are not durable
+    perror(journal.path);
+    journal.length = 0;
+    return -1;
+  }
+  journal.size += journal.length;
+
+  // apply records in order, like replay: deferred images reach their rows
+  // only now, and a row ends up as its last record either way
+  for (size_t offset = 0; offset < journal.length;) {
+    journal_record *record = (void *)journal.buffer + offset;
+    table *table = record->table == bindings_table.id ? &bindings_table
+                                                      : &reports_table;
+    memcpy(table->base + record->index * table->rowsize, record->image,
+           record->length);
+    journal.journaled[table->id][record->index / 64] |=
+        (uint64_t)1 << (record->index % 64);
+    offset += dd_storage_record_size(record->length);
+  }
+  journal.length = 0;
+
+  if (journal.size >= DD_STORAGE_JOURNAL_MAX) {
+    // journaled rows are synced with data file
+    return dd_storage_sync();
+  }
+  return 0;
+}
+
+/*
+ * stage after-image of row at index with length bytes of data
+ *
+ * returns:
+ * -  0 if data exceeds row, or journal can not be committed
+ * -  zeroed entry to fill in, then pass to dd_storage_write
+ */
+static table_entry *dd_storage_stage(table *table, size_t index,
+                                     size_t length) {
+  assert(table != 0);
+  assert(index < table->length);
+
+  if (table->rowsize < sizeof(table_entry) + length) {
+    // exceeds row size
+    return 0;
+  }
+
+  size_t size = dd_storage_record_size(sizeof(table_entry) + length);
+  assert(size <= sizeof(journal.buffer));
+  if (journal.length + size > sizeof(journal.buffer)) {
+    // make room
+    if (dd_storage_commit() != 0)
+      return 0;
+  }
+
+  journal_record *record = (void *)journal.buffer + journal.length;
+  bzero(record, size);
+  record->magic = DD_STORAGE_JOURNAL_MAGIC;
+  record->length = sizeof(table_entry) + length;
+  record->table = table->id;
+  record->index = index;
+
+  table_entry *image = (void *)record->image;
+  image->length = length;
+  return image;
+}
+
+/*
+ * seal staged image and append it to journal, its row is applied by
+ * dd_storage_commit
+ */
+static journal_record *dd_storage_append(table_entry *image) {
+  assert(image != 0);
+  journal_record *record = (void *)image - offsetof(journal_record, image);
+  assert(record == (void *)journal.buffer + journal.length);
+
+  image->checksum = dd_storage_entry_checksum(image);
+  record->sequence = journal.sequence++;
+  record->checksum = dd_storage_crc32(
+      record, sizeof(journal_record) + record->length, 0);
+  journal.length += dd_storage_record_size(record->length);
+  return record;
+}
+
+/*
+ * append staged image to journal and apply it to its row, committing first
+ * if sync, or if a torn update of the row could not be replayed
+ *
+ * returns -1 if image could not be committed, row is unchanged then
+ */
+static int dd_storage_write(table *table, table_entry *image, bool sync) {
+  assert(table != 0);
+  assert(image != 0);
+  journal_record *record = dd_storage_append(image);
+  table_entry *entry = table->base + record->index * table->rowsize;
+
+  uint64_t bit = (uint64_t)1 << (record->index % 64);
+  if (entry->valid == 1 && image->valid == 1 &&
+      (journal.journaled[table->id][record->index / 64] & bit) == 0) {
+    // only replaying a committed record restores an update torn by a crash
+    sync = true;
+  }
+
+  if (sync && dd_storage_commit() != 0) {
+    // not durable, leave row as is
+    return -1;
+  }
+
+  // apply
+  memcpy(table->base + record->index * table->rowsize, image, record->length);
+  return 0;
+}
+
+/*
+ * apply complete records of journal left behind, e.g. by a crash
+ *
+ * returns -1 on error
+ */
+static int dd_storage_replay() {
+  journal_record *record = (void *)journal.buffer;
+  size_t offset = 0;
+  size_t replayed = 0;
+
+  for (;;) {
+    ssize_t length = pread(journal.fd, record, sizeof(journal_record), offset);
+    if (length != sizeof(journal_record) ||
+        record->magic != DD_STORAGE_JOURNAL_MAGIC ||
+        record->length < sizeof(table_entry) ||
+        dd_storage_record_size(record->length) > sizeof(journal.buffer)) {
+      // end of journal
+      break;
+    }
+    length = pread(journal.fd, record->image, record->length,
+                   offset + sizeof(journal_record));
+    uint32_t checksum = record->checksum;
+    record->checksum = 0;
+    if (length != record->length ||
+        dd_storage_crc32(record, sizeof(journal_record) + record->length,
+                         0) != checksum) {
+      // torn tail, record was never committed
+      break;
+    }
+
+    table *table = record->table == bindings_table.id ? &bindings_table
+                                                      : &reports_table;
+    if (record->table > reports_table.id || record->index >= table->length ||
+        record->length > table->rowsize) {
+      // corrupt journal
+      fprintf(stderr, "%s: invalid record %llu\n", journal.path,
+              (unsigned long long)record->sequence);
+      return -1;
+    }
+    memcpy(table->base + record->index * table->rowsize, record->image,
+           record->length);
+
+    journal.sequence = record->sequence + 1;
+    offset += dd_storage_record_size(record->length);
+    replayed++;
+  }
+  if (replayed != 0)
+    fprintf(stderr, "%s: replayed %zu records\n", journal.path, replayed);
+
+  // start over with empty journal
+  return dd_storage_sync();
+}
+
+/*
+ * drop rows torn by a crash, and reconcile bitmap with rows
+ */
+static void dd_storage_recover_table(table *table) {
+  assert(table != 0);
+  size_t torn = 0;
+  size_t leaked = 0;
+
+  for (size_t index = 0; index < DD_STORAGE_BITMAP_WORDS * 64; index++) {
+    table_entry *entry = table->base + index * table->rowsize;
+    bool valid = index < table->length && entry->valid == 1;
+    if (valid && (sizeof(table_entry) + entry->length > table->rowsize ||
+                  dd_storage_entry_checksum(entry) != entry->checksum)) {
+      // written, but not committed, when crashed
+      entry->valid = 0;
+      valid = false;
+      torn++;
+    }
+
+    uint64_t bit = (uint64_t)1 << (index % 64);
+    bool used = table->header->used[index / 64] & bit;
+    if (used != valid) {
+      dd_storage_mark(table, index, valid);
+      leaked++;
+    }
+  }
+  if (torn != 0)
+    fprintf(stderr, "%s: dropped %zu torn rows\n", config.path, torn);
+  if (leaked != 0)
+    fprintf(stderr, "%s: reconciled %zu rows\n", config.path, leaked);
+}
+
+/*
+ * rename file to <path>.old, replacing an earlier one
+ *
+ * returns:
+ * -  0 on success, or if file does not exist
+ * - -1 on error
+ */
+static int dd_storage_move_aside(const char *path) {
+  assert(path != 0);
+  char old_path[sizeof(journal.path) + sizeof(".old")];
+
+  if (snprintf(old_path, sizeof(old_path), "%s.old", path) >=
+      sizeof(old_path)) {
+    fprintf(stderr, "%s: path too long\n", path);
+    return -1;
+  }
+  if (rename(path, old_path) != 0 && errno != ENOENT) {
+    // print error
+    perror(path);
+    return -1;
+  }
+
+  return 0;
+}
 
 int dd_storage_init(dd_device *device) {
+  // journal lives next to data file
+  if (snprintf(journal.path, sizeof(journal.path), "%s.journal",
+               config.path) >= sizeof(journal.path)) {
+    fprintf(stderr, "%s: path too long\n", config.path);
+    return -1;
+  }
+
   // open data file
-  fd = open("data.bin", O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+  fd = open(config.path, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
   if (fd == -1) {
     // print error once
     perror(0);
     return -1;
   }
 
-  // ensure size
-  int ret = posix_fallocate(fd, 0, 64 * 1024);
+  // read header of existing file, or prepare new one
+  pagesize = sysconf(_SC_PAGESIZE);
+  // keep rows 8-byte aligned
+  uint32_t bindings_rowsize = (config.bindings_rowsize + 7) & ~7;
+  uint32_t reports_rowsize = (config.reports_rowsize + 7) & ~7;
+  storage_header stored = {0};
+  ssize_t length = pread(fd, &stored, sizeof(stored), 0);
+  if (length == -1) {
+    // print error
+    perror(0);
+    return -1;
+  }
+  if (length > 0 &&
+      (length != sizeof(stored) || stored.magic != DD_STORAGE_MAGIC ||
+       stored.version != DD_STORAGE_VERSION)) {
+    // e.g. file of previous fixed layout, not migrated: keep it for
+    // inspection and start empty
+    fprintf(stderr, "%s: unknown format, moved to %s.old\n", config.path,
+            config.path);
+    close(fd);
+    if (dd_storage_move_aside(config.path) != 0 ||
+        dd_storage_move_aside(journal.path) != 0)
+      return -1;
+    fd = open(config.path, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+      // print error
+      perror(0);
+      return -1;
+    }
+    bzero(&stored, sizeof(stored));
+    length = 0;
+  }
+  if (length == 0) {
+    // new file
+    stored.magic = DD_STORAGE_MAGIC;
+    stored.version = DD_STORAGE_VERSION;
+    stored.pagesize = pagesize;
+    stored.size = stored.pagesize;
+    stored.bindings.rowsize = bindings_rowsize;
+    stored.reports.rowsize = reports_rowsize;
+  } else if (stored.pagesize != pagesize) {
+    fprintf(stderr, "%s: written with page size %u\n", config.path,
+            stored.pagesize);
+    return -1;
+  } else if (stored.bindings.rowsize != bindings_rowsize ||
+             stored.reports.rowsize != reports_rowsize) {
+    // rows can not be resized in place
+    fprintf(stderr, "%s: keeping row sizes %u and %u\n", config.path,
+            stored.bindings.rowsize, stored.reports.rowsize);
+  }
+  if (stored.bindings.rowsize < sizeof(table_entry) + sizeof(dd_binding) ||
+      stored.reports.rowsize < sizeof(table_entry) + sizeof(dd_report)) {
+    fprintf(stderr, "%s: row size too small\n", config.path);
+    return -1;
+  }
+  if (dd_storage_record_size(stored.bindings.rowsize) >
+          sizeof(journal.buffer) ||
+      dd_storage_record_size(stored.reports.rowsize) >
+          sizeof(journal.buffer)) {
+    fprintf(stderr, "%s: row size exceeds journal buffer\n", config.path);
+    return -1;
+  }
+
+  // ensure header page
+  int ret = posix_fallocate(fd, 0, stored.pagesize);
   if (ret != 0) {
     fprintf(stderr, "%s\n", strerror(ret));
-    // expect undefined behaviour
     return -1;
   }
 
-  // map to fixed virtual address
+  // reserve address space for header and table windows, without committing
+  // memory; below MAP_FIXED only ever replaces pages of this reservation
+  size_t bindings_window = dd_storage_window(stored.bindings.rowsize);
+  size_t reports_window = dd_storage_window(stored.reports.rowsize);
   if (map_base == 0) {
-    map_base =
-        mmap(map_base_hint, 64 * 1024, PROT_READ | PROT_WRITE | PROT_EXEC,
-             MAP_FIXED | MAP_SHARED, fd, 0);
-    if (map_base == 0) {
+    map_base = mmap(0, stored.pagesize + bindings_window + reports_window,
+                    PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                    -1, 0);
+    if (map_base == MAP_FAILED) {
       // print error
       perror(0);
+      map_base = 0;
       return -1;
     }
   }
 
-  // partition space among tables
-  bindings_table.base = map_base;
-  bindings_table.length = 32;
-  bindings_table.rowsize = 1024; // TODO: estimate reasonable row size
-  reports_table.base =
-      bindings_table.base + bindings_table.length * bindings_table.rowsize;
-  reports_table.length = 32;
-  reports_table.rowsize = 1024; // TODO: estimate reasonable row size
+  // map header
+  header = mmap(map_base, stored.pagesize, PROT_READ | PROT_WRITE,
+                MAP_FIXED | MAP_SHARED, fd, 0);
+  if (header == MAP_FAILED) {
+    // print error
+    perror(0);
+    header = 0;
+    return -1;
+  }
+  if (length == 0)
+    *header = stored;
+
+  // map tables
+  void *base = map_base + stored.pagesize;
+  if (dd_storage_map_table(&bindings_table, base, config.bindings_capacity,
+                           &header->bindings) != 0)
+    return -1;
+  base += bindings_window;
+  if (dd_storage_map_table(&reports_table, base, config.reports_capacity,
+                           &header->reports) != 0)
+    return -1;
+
+  // open journal
+  journal.fd = open(journal.path, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+  if (journal.fd == -1) {
+    // print error
+    perror(journal.path);
+    return -1;
+  }
 
-  // future: fix virtual addresses by storing previous in file
-  assert(map_base == map_base_hint);
+  // recover from crash
+  if (dd_storage_replay() != 0)
+    return -1;
+  dd_storage_recover_table(&bindings_table);
+  dd_storage_recover_table(&reports_table);
 
   // done
   return 0;
@@ -94,9 +788,33 @@ int dd_storage_init(dd_device *device) {
  * Accessors
  */
 
-static void *dd_storage_put(table *table, uint8_t eid, uint16_t cid,
-                            size_t *index, void *data, size_t size,
-                            void (*copy)(void *, size_t, void *)) {
+static size_t dd_storage_index(table *table, void *data) {
+  assert(table != 0);
+  assert(data != 0);
+
+  size_t index = (data - sizeof(table_entry) - table->base) / table->rowsize;
+  assert(index < table->length);
+  return index;
+}
+
+static bool dd_storage_sync_table(table *table) {
+  assert(table != 0);
+
+  dd_storage_durability durability = table == &bindings_table
+                                         ? config.bindings_durability
+                                         : config.reports_durability;
+  return durability == DD_STORAGE_SYNC;
+}
+
+/*
+ * stage new row in free slot, growing table if needed
+ *
+ * returns:
+ * -  0 if table is full, or size exceeds row
+ * -  staged entry, copy size bytes of data into it and pass to dd_storage_apply
+ */
+static table_entry *dd_storage_put(table *table, uint8_t eid, char role,
+                                   uint16_t cid, size_t size, size_t *index) {
   assert(table != 0);
   assert(index != 0);
 
@@ -107,148 +825,251 @@ static void *dd_storage_put(table *table, uint8_t eid, uint16_t cid,
 
   // find free slot
   assert(table->base != 0);
-  table_entry *slot = table->base;
-  *index = 0;
-  while (*index < table->length) {
-    if (slot->valid != 1)
-      break;
-
-    slot += table->rowsize;
-    (*index)++;
-  }
+  *index = dd_storage_first_free(table);
   if (*index >= table->length) {
-    // no free slot
-    return 0;
+    // no free slot, grow table
+    if (dd_storage_grow(table) != 0 || *index >= table->length)
+      return 0;
   }
 
-  // copy into table
-  assert(copy != 0);
-  copy(slot->data, table->rowsize - sizeof(table_entry), data);
+  table_entry *image = dd_storage_stage(table, *index, size);
+  if (image == 0)
+    return 0;
+  dd_storage_mark(table, *index, true);
+
+  image->eid = eid;
+  image->role = role;
+  image->cid = cid;
+  image->valid = 1;
+  return image;
+}
+
+/*
+ * stage row holding data, with size bytes of (updated) data
+ *
+ * returns:
+ * -  0 if size exceeds row
+ * -  staged entry, with header of current row
+ */
+static table_entry *dd_storage_restage(table *table, void *data, size_t size,
+                                       size_t *index) {
+  assert(table != 0);
+  assert(index != 0);
+  *index = dd_storage_index(table, data);
+  table_entry *entry = data - sizeof(table_entry);
 
-  // mark valid
-  slot->eid = eid;
-  slot->cid = cid;
-  slot->valid = 1;
+  table_entry *image = dd_storage_stage(table, *index, size);
+  if (image == 0)
+    return 0;
 
-  // return pointer to data
-  return slot->data;
+  image->eid = entry->eid;
+  image->role = entry->role;
+  image->cid = entry->cid;
+  image->valid = entry->valid;
+  return image;
 }
 
-static void *dd_storage_get(table *table, int index, uint8_t *eid,
+/*
+ * journal staged entry and apply it to row at index
+ *
+ * returns:
+ * -  0 if entry could not be committed, or is not valid (deleted)
+ * -  pointer to data of row
+ */
+static void *dd_storage_apply(table *table, size_t index, table_entry *image,
+                              bool sync) {
+  assert(table != 0);
+  assert(image != 0);
+  table_entry *entry = table->base + index * table->rowsize;
+
+  if (dd_storage_write(table, image, sync) != 0) {
+    // row unchanged
+    dd_storage_mark(table, index, entry->valid == 1);
+    return 0;
+  }
+
+  // release row only once written
+  dd_storage_mark(table, index, entry->valid == 1);
+  return entry->valid == 1 ? entry->data : 0;
+}
+
+static void *dd_storage_get(table *table, int index, uint8_t *eid, char *role,
                             uint16_t *cid) {
   assert(table != 0);
   table_entry *slot = table->base + index * table->rowsize;
 
   if (slot->valid == 1) {
     *eid = slot->eid;
+    *role = slot->role;
     *cid = slot->cid;
     return slot->data;
   }
   return 0;
 }
 
-dd_binding *dd_storage_bindings_put(uint8_t eid, uint16_t cid,
+static void dd_storage_delete(table *table, void *data) {
+  assert(table != 0);
+  assert(data != 0);
+  size_t index;
+
+  table_entry *image = dd_storage_restage(table, data, 0, &index);
+  if (image == 0) {
+    // journal failed, row stays
+    return;
+  }
+  image->valid = 0;
+  dd_storage_apply(table, index, image, dd_storage_sync_table(table));
+}
+
+dd_binding *dd_storage_bindings_put(uint8_t eid, char role, uint16_t cid,
                                     dd_binding *binding) {
+  assert(binding != 0);
   size_t index;
-  dd_binding *result =
-      dd_storage_put(&bindings_table, eid, cid, &index, binding,
-                     sizeof(dd_binding) + binding->length,
-                     (void (*)(void *, size_t, void *))dd_copy_binding);
-  if (result == 0) {
+  table_entry *image = dd_storage_put(&bindings_table, eid, role, cid,
+                                      sizeof(dd_binding) + binding->length,
+                                      &index);
+  if (image == 0) {
     // oom
     return 0;
   }
 
-  // derive id from index
-  result->id = index + 1;
+  // copy into staged row, deriving id from index
+  dd_binding *staged = dd_copy_binding(image->data, image->length, binding);
+  staged->id = index + 1;
 
   // return pointer to storage
-  return result;
+  return dd_storage_apply(&bindings_table, index, image,
+                          dd_storage_sync_table(&bindings_table));
 }
 
 dd_binding *dd_storage_bindings_update(dd_binding *orig, dd_binding *updated) {
   assert(orig != 0);
   assert(updated != 0);
+  size_t index;
 
   // TODO: revisit regarding non-mmap storage implementations ...
-  return dd_copy_binding(orig, bindings_table.rowsize, updated);
+  table_entry *image = dd_storage_restage(
+      &bindings_table, orig, sizeof(dd_binding) + updated->length, &index);
+  if (image == 0) {
+    // oom
+    return 0;
+  }
+  dd_copy_binding(image->data, image->length, updated);
+  return dd_storage_apply(&bindings_table, index, image,
+                          dd_storage_sync_table(&bindings_table));
 }
 
 void dd_storage_bindings_delete(dd_binding *orig) {
   assert(orig != 0);
 
   // TODO: revisit regarding non-mmap storage implementations ...
+  dd_storage_delete(&bindings_table, orig);
+}
+
+void dd_storage_bindings_touch(dd_binding *orig, time_t timestamp) {
+  assert(orig != 0);
   table_entry *entry = (void *)orig - sizeof(table_entry);
-  entry->valid = 0;
+  size_t index;
+
+  // journal timestamp with next group commit, timestamps are lazy anyway
+  // TODO: revisit regarding non-mmap storage implementations ...
+  table_entry *image =
+      dd_storage_restage(&bindings_table, orig, entry->length, &index);
+  if (image == 0) {
+    // journal failed, timestamp stays volatile
+    return;
+  }
+  memcpy(image->data, entry->data, entry->length);
+  ((dd_binding *)image->data)->timestamp = timestamp;
+  // row is written once committed, so that it is never torn
+  dd_storage_append(image);
 }
 
-dd_report *dd_storage_reports_put(uint8_t eid, uint16_t cid,
+dd_report *dd_storage_reports_put(uint8_t eid, char role, uint16_t cid,
                                   dd_report *report) {
   assert(report != 0);
   size_t index;
-  dd_report *result =
-      dd_storage_put(&reports_table, eid, cid, &index, report,
-                     sizeof(dd_report) + report->length,
-                     (void (*)(void *, size_t, void *))dd_copy_report);
-  if (result == 0) {
+  table_entry *image =
+      dd_storage_put(&reports_table, eid, role, cid,
+                     sizeof(dd_report) + report->length, &index);
+  if (image == 0) {
     // oom
     return 0;
   }
 
-  // derive id from index
-  result->id = index + 1;
+  // copy into staged row, deriving id from index
+  dd_report *staged = dd_copy_report(image->data, image->length, report);
+  staged->id = index + 1;
 
   // return pointer to storage
-  return result;
+  return dd_storage_apply(&reports_table, index, image,
+                          dd_storage_sync_table(&reports_table));
 }
 
 dd_report *dd_storage_reports_update(dd_report *orig, dd_report *updated) {
   assert(orig != 0);
   assert(updated != 0);
+  size_t index;
 
   // TODO: revisit regarding non-mmap storage implementations ...
-  return dd_copy_report(orig, reports_table.rowsize, updated);
+  table_entry *image = dd_storage_restage(
+      &reports_table, orig, sizeof(dd_report) + updated->length, &index);
+  if (image == 0) {
+    // oom
+    return 0;
+  }
+  dd_copy_report(image->data, image->length, updated);
+  return dd_storage_apply(&reports_table, index, image,
+                          dd_storage_sync_table(&reports_table));
 }
 
 void dd_storage_reports_delete(dd_report *orig) {
   assert(orig != 0);
 
   // TODO: revisit regarding non-mmap storage implementations ...
-  table_entry *entry = (void *)orig - sizeof(table_entry);
-  entry->valid = 0;
+  dd_storage_delete(&reports_table, orig);
 }
 
 /*
  * link tables into resource tree
+ *
+ * Note: clusters are looked up in the route table generated with the resource
+ * tree, so that linking is linear in the number of rows.
  */
+static dd_cluster *dd_storage_find_cluster(dd_device *device, uint8_t eid,
+                                           char role, uint16_t cid) {
+  assert(device != 0);
+
+  dd_route *route = dd_find_route(device, DD_ROUTE_KEY(eid, role, cid, 0, 0));
+  if (route == 0) {
+    // e.g. cluster removed from resource tree since row was written
+    return 0;
+  }
+  return route->cluster;
+}
+
 static void dd_storage_link_bindings(dd_device *device) {
   assert(device != 0);
 
   // link resource tree (bindings)
   for (size_t i = 0; i < bindings_table.length; i++) {
     uint8_t eid;
+    char role;
     uint16_t cid;
 
-    // really bad algorithm right here ... ... ... !
-    dd_binding *binding = dd_storage_get(&bindings_table, i, &eid, &cid);
-    if (binding != 0) {
-      // report configuration exists
-      assert(device != 0);
-      for (int j = 0; j < device->endpoints_length; j++) {
-        dd_endpoint *endpoint = device->endpoints[j];
-        if (endpoint->id == eid) {
-          for (int k = 0; k < endpoint->cluster_length; k++) {
-            dd_cluster *cluster = endpoint->cluster[k];
-            if (cluster->id == cid) {
-              assert(cluster->bindings_length < DD_CLUSTER_BINDINGS_MAX);
-              cluster->bindings[cluster->bindings_length++] = binding;
-              goto dd_storage_init__nextbinding;
-            }
-          }
-        }
-      }
+    dd_binding *binding = dd_storage_get(&bindings_table, i, &eid, &role, &cid);
+    if (binding == 0)
+      continue;
+
+    dd_cluster *cluster = dd_storage_find_cluster(device, eid, role, cid);
+    if (cluster == 0) {
+      // keep row, but do not serve it
+      fprintf(stderr, "binding %zu: no cluster %c%x on endpoint %u\n", i + 1,
+              role, cid, eid);
+      continue;
     }
-  dd_storage_init__nextbinding:;
+    int ret = dd_insert_binding(cluster, binding);
+    assert(ret == 0);
   }
 }
 
@@ -258,32 +1079,26 @@ static void dd_storage_link_reports(dd_device *device) {
   // link resource tree (reports)
   for (size_t i = 0; i < reports_table.length; i++) {
     uint8_t eid;
+    char role;
     uint16_t cid;
 
-    // really bad algorithm right here ... ... ... !
-    dd_report *report = dd_storage_get(&reports_table, i, &eid, &cid);
-    if (report != 0) {
-      // report configuration exists
-      assert(device != 0);
-      for (int j = 0; j < device->endpoints_length; j++) {
-        dd_endpoint *endpoint = device->endpoints[i];
-        if (endpoint->id == eid) {
-          for (int k = 0; k < endpoint->cluster_length; k++) {
-            dd_cluster *cluster = endpoint->cluster[k];
-            if (cluster->id == cid) {
-              assert(cluster->reports_length < DD_CLUSTER_REPORTS_MAX);
-              cluster->reports[cluster->reports_length++] = report;
-              goto dd_storage_init__nextreport;
-            }
-          }
-        }
-      }
+    dd_report *report = dd_storage_get(&reports_table, i, &eid, &role, &cid);
+    if (report == 0)
+      continue;
+
+    dd_cluster *cluster = dd_storage_find_cluster(device, eid, role, cid);
+    if (cluster == 0) {
+      // keep row, but do not serve it
+      fprintf(stderr, "report %zu: no cluster %c%x on endpoint %u\n", i + 1,
+              role, cid, eid);
+      continue;
     }
-  dd_storage_init__nextreport:;
+    int ret = dd_insert_report(cluster, report);
+    assert(ret == 0);
   }
 }
 
 void dd_storage_link(dd_device *device) {
-  dd_storage_link_bindings(device);
   dd_storage_link_reports(device);
+  dd_storage_link_bindings(device);
 }
@@ -5,6 +5,7 @@
 #define HAVE_DDSTORAGE_H
 
 #include <stdint.h>
+#include <time.h>
 
 struct dd_device;
 typedef struct dd_device dd_device;
@@ -15,25 +16,68 @@ typedef struct dd_report dd_report;
 
 /*
  * ZCL Persistent Storage Abstraction Layer
+ *
+ * Mutations are journaled (see dd_storage_commit), so that a crash leaves
+ * each row either as it was, or as written.
  */
 
+enum dd_storage_durability {
+  DD_STORAGE_SYNC,  // mutation returns once journaled durably
+  DD_STORAGE_GROUP, // mutation becomes durable with next dd_storage_commit
+};
+typedef enum dd_storage_durability dd_storage_durability;
+
+/*
+ * configure data file and tables, before dd_storage_init
+ *
+ * Tables grow on demand up to capacity rows (at most UINT8_MAX, as ids are
+ * uint8) of given size in bytes. 0 or null keep the default of "data.bin" and
+ * UINT8_MAX rows of 1024 bytes.
+ *
+ * Note: row sizes of an existing file take precedence.
+ */
+void dd_storage_configure(const char *path, uint8_t bindings,
+                          uint16_t bindings_rowsize, uint8_t reports,
+                          uint16_t reports_rowsize);
+
+/*
+ * configure durability of mutations per table, default DD_STORAGE_SYNC
+ *
+ * Note: notification timestamps (dd_storage_bindings_touch) are always group
+ * committed. The first group committed update of a row after the journal was
+ * truncated still commits right away, so that a crash can not tear it.
+ */
+void dd_storage_set_durability(dd_storage_durability bindings,
+                               dd_storage_durability reports);
+
 int dd_storage_init();
+
+/*
+ * write pending journal records with one sync, i.e. group commit
+ *
+ * returns -1 on error, pending mutations are not durable then
+ */
+int dd_storage_commit();
 void dd_storage_link(dd_device *device);
 
 /*
  * Binding Table
  */
-dd_binding *dd_storage_bindings_put(uint8_t eid, uint16_t cid,
+dd_binding *dd_storage_bindings_put(uint8_t eid, char role, uint16_t cid,
                                     dd_binding *binding);
-dd_binding *dd_storage_bindings_get(int index, uint8_t *eid, uint16_t *cid);
+dd_binding *dd_storage_bindings_get(int index, uint8_t *eid, char *role,
+                                    uint16_t *cid);
 dd_binding *dd_storage_bindings_update(dd_binding *orig, dd_binding *updated);
 void dd_storage_bindings_delete(dd_binding *orig);
+void dd_storage_bindings_touch(dd_binding *orig, time_t timestamp);
 
 /*
  * Report Configuration Table
  */
-dd_report *dd_storage_reports_put(uint8_t eid, uint16_t cid, dd_report *report);
-dd_report *dd_storage_reports_get(int index, uint8_t *eid, uint16_t *cid);
+dd_report *dd_storage_reports_put(uint8_t eid, char role, uint16_t cid,
+                                  dd_report *report);
+dd_report *dd_storage_reports_get(int index, uint8_t *eid, char *role,
+                                  uint16_t *cid);
 dd_report *dd_storage_reports_update(dd_report *orig, dd_report *updated);
 void dd_storage_reports_delete(dd_report *orig);
 
@@ -4,77 +4,44 @@
 #include <assert.h>
 #include <string.h>
 
+#include "dd_coap.h"
 #include "dd_types.h"
 
-static void fix_binding(dd_binding *new, dd_binding *orig);
-static void fix_report(dd_report *new, dd_report *orig);
-static void fix_report_attribute(dd_report_attribute *new,
-                                 dd_report_attribute *orig);
-static void fix_uri(dd_uri *new, dd_uri *orig);
-static void fix_value(dd_value *new, dd_value *orig);
-
-static void fix_binding(dd_binding *new, dd_binding *orig) {
-  if (orig->uri != 0) {
-    assert((void *)orig->uri > (void *)orig &&
-           (void *)orig->uri < (void *)orig->_buffer + orig->length);
-    new->uri = (void *)orig->uri - (void *)orig->_buffer + (void *)new->_buffer;
-    fix_uri(new->uri, orig->uri);
-  }
+void *dd_ref_get(const dd_ref *ref) {
+  assert(ref != 0);
+
+  if (*ref == 0)
+    return 0;
+  return (char *)ref + *ref;
 }
 
-static void fix_report(dd_report *new, dd_report *orig) {
-  if (orig->attributes != 0) {
-    assert((void *)orig->attributes > (void *)orig &&
-           (void *)orig->attributes < (void *)orig->_buffer + orig->length);
-    new->attributes =
-        (void *)orig->attributes - (void *)orig->_buffer + (void *)new->_buffer;
-    for (size_t i = 0; i < orig->attributes_length;) {
-      fix_report_attribute(new->attributes + i, orig->attributes + i);
-      i += sizeof(dd_report_attribute) + (orig->attributes + i)->length;
-    }
+void dd_ref_set(dd_ref *ref, const void *target) {
+  assert(ref != 0);
+
+  if (target == 0) {
+    *ref = 0;
+    return;
   }
+  *ref = (const char *)target - (char *)ref;
+  assert(*ref != 0);
 }
 
-static void fix_report_attribute(dd_report_attribute *new,
-                                 dd_report_attribute *orig) {
-  if (orig->reportable_change != 0) {
-    assert((void *)orig->reportable_change > (void *)orig &&
-           (void *)orig->reportable_change <
-               (void *)orig->_buffer + orig->length);
-    new->reportable_change = (void *)orig->reportable_change -
-                             (void *)orig->_buffer + (void *)new->_buffer;
-    fix_value(new->reportable_change, orig->reportable_change);
-  }
-  if (orig->low_threshold != 0) {
-    assert((void *)orig->low_threshold > (void *)orig &&
-           (void *)orig->low_threshold < (void *)orig->_buffer + orig->length);
-    new->low_threshold = (void *)orig->low_threshold - (void *)orig->_buffer +
-                         (void *)new->_buffer;
-    fix_value(new->low_threshold, orig->low_threshold);
-  }
-  if (orig->high_threshold) {
-    assert((void *)orig->high_threshold > (void *)orig &&
-           (void *)orig->high_threshold < (void *)orig->_buffer + orig->length);
-    new->high_threshold = (void *)orig->high_threshold - (void *)orig->_buffer +
-                          (void *)new->_buffer;
-    fix_value(new->high_threshold, orig->high_threshold);
-  }
+dd_uri *dd_binding_uri(const dd_binding *binding) {
+  assert(binding != 0);
+
+  return dd_ref_get(&binding->uri);
 }
 
-static void fix_uri(dd_uri *new, dd_uri *orig) {
-  assert((void *)orig->host > (void *)orig &&
-         (void *)orig->host < (void *)orig->_buffer + orig->length);
-  new->host = (void *)orig->host - (void *)orig->_buffer + (void *)new->_buffer;
-  assert((void *)orig->path > (void *)orig &&
-         (void *)orig->path < (void *)orig->_buffer + orig->length);
-  new->path = (void *)orig->path - (void *)orig->_buffer + (void *)new->_buffer;
+const char *dd_uri_host(const dd_uri *uri) {
+  assert(uri != 0);
+
+  return dd_ref_get(&uri->host);
 }
 
-static void fix_value(dd_value *new, dd_value *orig) {
-  if (orig->value.vstring != 0) {
-    new->value.vstring = (void *)orig->value.vstring - (void *)orig->_buffer +
-                         (void *)new->_buffer;
-  }
+const char *dd_uri_path(const dd_uri *uri) {
+  assert(uri != 0);
+
+  return dd_ref_get(&uri->path);
 }
 
 dd_binding *dd_copy_binding(void *destination, size_t destination_size,
@@ -86,9 +53,8 @@ dd_binding *dd_copy_binding(void *destination, size_t destination_size,
     return 0;
   }
 
-  // memcpy + fix pointers
+  // records are position-independent, plain copy
   memcpy(destination, source, sizeof(dd_binding) + source->length);
-  fix_binding(destination, source);
 
   return destination;
 }
@@ -102,9 +68,8 @@ dd_report *dd_copy_report(void *destination, size_t destination_size,
     return 0;
   }
 
-  // memcpy + fix pointers
+  // records are position-independent, plain copy
   memcpy(destination, source, sizeof(dd_report) + source->length);
-  fix_report(destination, source);
 
   return destination;
 }
@@ -119,9 +84,8 @@ dd_report_attribute *dd_copy_report_attribute(void *destination,
     return 0;
   }
 
-  // memcpy + fix pointers
+  // records are position-independent, plain copy
   memcpy(destination, source, sizeof(dd_report_attribute) + source->length);
-  fix_report_attribute(destination, source);
 
   return destination;
 }
@@ -135,13 +99,29 @@ dd_uri *dd_copy_uri(void *destination, size_t destination_size,
     return 0;
   }
 
-  // memcpy + fix pointers
-  memcpy(destination, source, sizeof(dd_report_attribute) + source->length);
-  fix_uri(destination, source);
+  // records are position-independent, plain copy
+  memcpy(destination, source, sizeof(dd_uri) + source->length);
 
   return destination;
 }
 
+bool dd_uri_equals(const dd_uri *a, const dd_uri *b) {
+  assert(a != 0);
+  assert(b != 0);
+
+  if (a->scheme != b->scheme || a->port != b->port)
+    return false;
+  const char *a_host = dd_uri_host(a), *b_host = dd_uri_host(b);
+  if ((a_host == 0 || b_host == 0) ? a_host != b_host
+                                   : strcmp(a_host, b_host) != 0)
+    return false;
+  const char *a_path = dd_uri_path(a), *b_path = dd_uri_path(b);
+  if ((a_path == 0 || b_path == 0) ? a_path != b_path
+                                   : strcmp(a_path, b_path) != 0)
+    return false;
+  return true;
+}
+
 dd_value *dd_copy_value(void *destination, size_t destination_size,
                         dd_value *source) {
   assert(source != 0);
@@ -151,13 +131,344 @@ dd_value *dd_copy_value(void *destination, size_t destination_size,
     return 0;
   }
 
-  // memcpy + fix pointers
+  // records are position-independent, plain copy
   memcpy(destination, source, sizeof(dd_value) + source->length);
-  fix_value(destination, source);
 
   return destination;
 }
 
+dd_route *dd_find_route(dd_device *device, uint64_t key) {
+  assert(device != 0);
+  size_t lower = 0, upper = device->routes_length;
+
+  // binary search route table
+  while (lower < upper) {
+    size_t middle = lower + (upper - lower) / 2;
+    dd_route *route = &device->routes[middle];
+    if (route->key == key)
+      return route;
+
+    if (route->key < key)
+      lower = middle + 1;
+    else
+      upper = middle;
+  }
+
+  // no such route
+  return 0;
+}
+
+dd_attribute *dd_find_attribute(dd_cluster *cluster, uint16_t aid) {
+  assert(cluster != 0);
+  size_t lower = 0, upper = cluster->attributes_length;
+
+  // binary search attribute table, sorted by codegen
+  while (lower < upper) {
+    size_t middle = lower + (upper - lower) / 2;
+    dd_attribute *attribute = cluster->attributes[middle];
+    if (attribute->id == aid)
+      return attribute;
+
+    if (attribute->id < aid)
+      lower = middle + 1;
+    else
+      upper = middle;
+  }
+
+  // no such attribute
+  return 0;
+}
+
+dd_binding *dd_find_binding(dd_cluster *cluster, uint8_t bid) {
+  assert(cluster != 0);
+  size_t lower = 0, upper = cluster->bindings_length;
+
+  // binary search binding table
+  while (lower < upper) {
+    size_t middle = lower + (upper - lower) / 2;
+    dd_binding *binding = cluster->bindings[middle];
+    if (binding->id == bid)
+      return binding;
+
+    if (binding->id < bid)
+      lower = middle + 1;
+    else
+      upper = middle;
+  }
+
+  // no such binding
+  return 0;
+}
+
+dd_report *dd_find_report(dd_cluster *cluster, uint8_t rid) {
+  assert(cluster != 0);
+  size_t lower = 0, upper = cluster->reports_length;
+
+  // binary search report configuration table
+  while (lower < upper) {
+    size_t middle = lower + (upper - lower) / 2;
+    dd_report *report = cluster->reports[middle];
+    if (report->id == rid)
+      return report;
+
+    if (report->id < rid)
+      lower = middle + 1;
+    else
+      upper = middle;
+  }
+
+  // no such report configuration
+  return 0;
+}
+
+/*
+ * volatile links between persistent records and resource tree, by binding and
+ * report id
+ *
+ * Note: built while linking storage into resource tree, and kept current by
+ * insert and remove below.
+ */
+static struct {
+  dd_report *reports[UINT8_MAX + 1];
+  dd_attribute *attributes[UINT8_MAX + 1][DD_REPORT_ATTRIBUTES_MAX];
+} links;
+
+void dd_link_binding(dd_cluster *cluster, dd_binding *binding) {
+  assert(cluster != 0);
+  assert(binding != 0);
+
+  links.reports[binding->id] = dd_find_report(cluster, binding->rid);
+}
+
+static void dd_link_report(dd_cluster *cluster, dd_report *report) {
+  assert(cluster != 0);
+  assert(report != 0);
+
+  // link attribute configurations to attribute instances
+  size_t i = 0;
+  for (dd_report_attribute *configuration = dd_report_attribute_next(report, 0);
+       configuration != 0 && i < DD_REPORT_ATTRIBUTES_MAX;
+       configuration = dd_report_attribute_next(report, configuration), i++) {
+    links.attributes[report->id][i] =
+        dd_find_attribute(cluster, configuration->aid);
+  }
+
+  // link bindings referencing report
+  for (size_t j = 0; j < cluster->bindings_length; j++) {
+    if (cluster->bindings[j]->rid == report->id)
+      links.reports[cluster->bindings[j]->id] = report;
+  }
+}
+
+static void dd_unlink_report(dd_cluster *cluster, dd_report *report) {
+  assert(cluster != 0);
+  assert(report != 0);
+
+  bzero(links.attributes[report->id], sizeof(links.attributes[report->id]));
+  for (size_t i = 0; i < cluster->bindings_length; i++) {
+    if (links.reports[cluster->bindings[i]->id] == report)
+      links.reports[cluster->bindings[i]->id] = 0;
+  }
+}
+
+dd_report *dd_binding_report(dd_binding *binding) {
+  assert(binding != 0);
+
+  return links.reports[binding->id];
+}
+
+dd_attribute *dd_report_attribute_link(dd_cluster *cluster, dd_report *report,
+                                       size_t index,
+                                       dd_report_attribute *configuration) {
+  assert(cluster != 0);
+  assert(report != 0);
+  assert(configuration != 0);
+
+  if (index < DD_REPORT_ATTRIBUTES_MAX)
+    return links.attributes[report->id][index];
+
+  // not linked
+  return dd_find_attribute(cluster, configuration->aid);
+}
+
+int dd_insert_binding(dd_cluster *cluster, dd_binding *binding) {
+  assert(cluster != 0);
+  assert(binding != 0);
+
+  if (cluster->bindings_length >= DD_CLUSTER_BINDINGS_MAX) {
+    // table full
+    return -1;
+  }
+
+  // shift entries with greater id up
+  size_t i = cluster->bindings_length;
+  while (i > 0 && cluster->bindings[i - 1]->id > binding->id) {
+    cluster->bindings[i] = cluster->bindings[i - 1];
+    i--;
+  }
+  cluster->bindings[i] = binding;
+  cluster->bindings_length++;
+  cluster->bindings_generation++;
+  dd_link_binding(cluster, binding);
+
+  return 0;
+}
+
+void dd_remove_binding(dd_cluster *cluster, dd_binding *binding) {
+  assert(cluster != 0);
+  assert(binding != 0);
+
+  // shift entries following binding down
+  int removed = 0;
+  for (size_t i = 0; i < cluster->bindings_length; i++) {
+    if (cluster->bindings[i] == binding) {
+      removed = 1;
+    } else if (removed) {
+      cluster->bindings[i - 1] = cluster->bindings[i];
+    }
+  }
+  assert(removed == 1);
+  links.reports[binding->id] = 0;
+  cluster->bindings_length--;
+  cluster->bindings_generation++;
+  cluster->bindings[cluster->bindings_length] = 0;
+}
+
+int dd_insert_report(dd_cluster *cluster, dd_report *report) {
+  assert(cluster != 0);
+  assert(report != 0);
+
+  if (cluster->reports_length >= DD_CLUSTER_REPORTS_MAX) {
+    // table full
+    return -1;
+  }
+
+  // shift entries with greater id up
+  size_t i = cluster->reports_length;
+  while (i > 0 && cluster->reports[i - 1]->id > report->id) {
+    cluster->reports[i] = cluster->reports[i - 1];
+    i--;
+  }
+  cluster->reports[i] = report;
+  cluster->reports_length++;
+  cluster->reports_generation++;
+  dd_link_report(cluster, report);
+
+  return 0;
+}
+
+void dd_remove_report(dd_cluster *cluster, dd_report *report) {
+  assert(cluster != 0);
+  assert(report != 0);
+
+  // shift entries following report configuration down
+  int removed = 0;
+  for (size_t i = 0; i < cluster->reports_length; i++) {
+    if (cluster->reports[i] == report) {
+      removed = 1;
+    } else if (removed) {
+      cluster->reports[i - 1] = cluster->reports[i];
+    }
+  }
+  assert(removed == 1);
+  dd_unlink_report(cluster, report);
+  cluster->reports_length--;
+  cluster->reports_generation++;
+  cluster->reports[cluster->reports_length] = 0;
+}
+
+dd_report_attribute *dd_report_attribute_next(dd_report *report,
+                                              dd_report_attribute *current) {
+  assert(report != 0);
+
+  void *attributes = dd_ref_get(&report->attributes);
+  if (attributes == 0) {
+    // no attribute configurations
+    return 0;
+  }
+
+  // entries are variable sized, attributes_length is in bytes
+  void *next = attributes;
+  if (current != 0)
+    next = (void *)current + sizeof(dd_report_attribute) + current->length;
+  if (next >= attributes + report->attributes_length)
+    return 0;
+
+  return next;
+}
+
+static bool dd_value_equals(dd_value *a, dd_value *b) {
+  assert(a != 0);
+  assert(b != 0);
+
+  if (a->type != b->type)
+    return false;
+
+  switch (a->type) {
+  case DD_BOOL:
+    return a->value.vbool == b->value.vbool;
+  case DD_INT:
+    return a->value.vint == b->value.vint;
+  case DD_UINT:
+    return a->value.vuint == b->value.vuint;
+  case DD_TIME:
+    return a->value.vtime == b->value.vtime;
+  case DD_STRING:
+    return strcmp(dd_value_to_string(a), dd_value_to_string(b)) == 0;
+  }
+  return false;
+}
+
+void dd_attribute_changed(dd_attribute *attribute, dd_value *value) {
+  assert(attribute != 0);
+  dd_attribute_cache *cache = &attribute->cache;
+
+  if (value != 0 && cache->value != 0 && dd_value_equals(cache->value, value)) {
+    // unchanged
+    return;
+  }
+
+  cache->version++;
+  cache->timestamp = time(0);
+
+  // Note: values too large for the cache are read through the handler
+  cache->value = 0;
+  if (value != 0)
+    cache->value = dd_copy_value(cache->_buffer, sizeof(cache->_buffer), value);
+
+  // notify observers, libcoap sends on next io processing
+  if (attribute->resource != 0)
+    coap_resource_notify_observers(attribute->resource, 0);
+}
+
+dd_value *dd_attribute_read(dd_attribute *attribute, void *buffer,
+                            size_t buffer_size) {
+  assert(attribute != 0);
+
+  if (attribute->cache.value != 0) {
+    // valid until next change
+    return attribute->cache.value;
+  }
+
+  return attribute->read(buffer, buffer_size);
+}
+
+void dd_attribute_write(dd_attribute *attribute, dd_value *value) {
+  assert(attribute != 0);
+  assert(value != 0);
+
+  attribute->write(value);
+
+  if (attribute->cache.version != 0) {
+    // application uses the cache, refresh it with what was actually stored
+    char buffer[DD_ATTRIBUTE_CACHE_SIZE];
+    dd_attribute_changed(attribute, attribute->read(buffer, sizeof(buffer)));
+  } else if (attribute->resource != 0) {
+    // not cached, observers read through the handler
+    coap_resource_notify_observers(attribute->resource, 0);
+  }
+}
+
 bool dd_value_to_bool(dd_value *value) {
   assert(value != 0);
   assert(value->type == DD_BOOL);
@@ -304,7 +615,7 @@ const char *dd_value_to_string(dd_value *value) {
   assert(value != 0);
   assert(value->type == DD_STRING);
 
-  return value->value.vstring;
+  return dd_ref_get(&value->value.vstring);
 }
 
 dd_value *dd_string_to_value(const char *vstring, void *buffer,
@@ -316,7 +627,7 @@ dd_value *dd_string_to_value(const char *vstring, void *buffer,
   dd_value *value = buffer;
   bzero(value, sizeof(dd_value));
   value->type = DD_STRING;
-  value->value.vstring = value->_buffer;
+  dd_ref_set(&value->value.vstring, value->_buffer);
   value->length = strlen(vstring) + 1;
   if (sizeof(dd_value) + value->length > buffer_size) {
     // oom
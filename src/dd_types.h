@@ -15,8 +15,12 @@
 
 struct dd_attribute;
 typedef struct dd_attribute dd_attribute;
+struct dd_attribute_cache;
+typedef struct dd_attribute_cache dd_attribute_cache;
 struct dd_binding;
 typedef struct dd_binding dd_binding;
+struct dd_binding_state;
+typedef struct dd_binding_state dd_binding_state;
 struct dd_cluster;
 typedef struct dd_cluster dd_cluster;
 struct dd_command;
@@ -31,6 +35,10 @@ struct dd_report;
 typedef struct dd_report dd_report;
 struct dd_report_attribute;
 typedef struct dd_report_attribute dd_report_attribute;
+struct dd_reported_value;
+typedef struct dd_reported_value dd_reported_value;
+struct dd_route;
+typedef struct dd_route dd_route;
 enum dd_scheme;
 typedef enum dd_scheme dd_scheme;
 struct dd_uri;
@@ -46,25 +54,65 @@ typedef void (*dd_attribute_write_handler)(dd_value *value);
 typedef void (*dd_command_handler)();
 typedef void (*dd_notification_handler)(dd_notification *notification);
 
+// self-relative reference, offset in bytes from the reference to its target,
+// 0 for none; stays valid when the record holding both is copied or mapped at
+// another address, see dd_ref_get
+typedef int32_t dd_ref;
+
+enum dd_value_type {
+  DD_BOOL,
+  DD_INT,
+  DD_UINT,
+  DD_TIME,
+  DD_STRING,
+};
+
+// largest value (including dd_value header) kept in attribute cache
+#define DD_ATTRIBUTE_CACHE_SIZE 64
+
+struct dd_attribute_cache {
+  // incremented on every change of the value
+  uint32_t version;
+  // time of last change
+  time_t timestamp;
+
+  // last value pushed by application, 0 when not cached
+  dd_value *value;
+  char _buffer[DD_ATTRIBUTE_CACHE_SIZE]; // storage for value
+};
+
 struct dd_attribute {
   // each attribute has a unique id
   uint16_t id;
   // each attribute has a name
   const char *name;
 
+  // each attribute has a value type, integers have an inclusive range
+  dd_value_type type;
+  int64_t min;
+  int64_t max;
+
   // each attribute has read and write handlers
   dd_attribute_read_handler read;
   dd_attribute_write_handler write;
+
+  // each attribute has an (optional) value cache, see dd_attribute_changed
+  dd_attribute_cache cache;
+
+  // observable coap resource (created by dd_init)
+  struct coap_resource_t *resource;
 };
 
 struct dd_binding {
   // each binding has a unique id
   uint8_t id;
 
-  // each binding has a destination uri
-  dd_uri *uri;
+  // each binding has a destination uri, see dd_binding_uri
+  dd_ref uri;
   // each binding has a report identifier
   uint8_t rid;
+  // notifications are sent confirmable (extension, key "c")
+  bool confirmable;
 
   // timestamp of last notification
   time_t timestamp;
@@ -83,18 +131,24 @@ struct dd_cluster {
   // each cluster instance can optionally have a specific manufacturer id
   uint16_t manufacturer;
 
-  // a cluster contains attributes
+  // a cluster contains attributes (sorted by id)
   dd_attribute **attributes;
   size_t attributes_length;
-  // and bindings (dynamic)
+  const uint8_t *attributes_cbor; // pre-encoded id array (generated)
+  size_t attributes_cbor_length;
+  // and bindings (dynamic, sorted by id)
   dd_binding *bindings[DD_CLUSTER_BINDINGS_MAX];
   size_t bindings_length;
+  uint32_t bindings_generation; // incremented on every change, see etag
   // and commands
   dd_command **commands;
   size_t commands_length;
-  // and report configurations (dynamic)
+  const uint8_t *commands_cbor; // pre-encoded id array (generated)
+  size_t commands_cbor_length;
+  // and report configurations (dynamic, sorted by id)
   dd_report *reports[DD_CLUSTER_REPORTS_MAX];
   size_t reports_length;
+  uint32_t reports_generation; // incremented on every change, see etag
   // and (optional) notification handler
   dd_notification_handler notify;
 };
@@ -111,6 +165,11 @@ struct dd_device {
   // a device contains endpoints
   dd_endpoint **endpoints;
   size_t endpoints_length;
+  const uint8_t *endpoints_cbor; // pre-encoded id array (generated)
+  size_t endpoints_cbor_length;
+  // and a route table sorted by key (generated)
+  dd_route *routes;
+  size_t routes_length;
 };
 
 struct dd_endpoint {
@@ -121,6 +180,8 @@ struct dd_endpoint {
   // an endpoint contains clusters
   dd_cluster **cluster;
   size_t cluster_length;
+  const uint8_t *cluster_cbor; // pre-encoded name array (generated)
+  size_t cluster_cbor_length;
 };
 
 struct dd_notification {
@@ -140,8 +201,9 @@ struct dd_report {
   uint16_t min_reporting_interval;
   uint16_t max_reporting_interval;
 
-  // each report configuration has an attribute configuration
-  dd_report_attribute *attributes;
+  // each report configuration has an attribute configuration, see
+  // dd_report_attribute_next
+  dd_ref attributes;
   size_t attributes_length;
 
   size_t length;  // number of bytes appended in _buffer
@@ -152,14 +214,59 @@ struct dd_report_attribute {
   uint16_t aid;
 
   // note: thresholds can only be analog types (int,uint,float,time)
-  dd_value *reportable_change;
-  dd_value *low_threshold;
-  dd_value *high_threshold;
+  dd_ref reportable_change; // dd_value
+  dd_ref low_threshold;     // dd_value
+  dd_ref high_threshold;    // dd_value
 
   unsigned int length; // number of bytes appended in _buffer
   char _buffer[];
 };
 
+// number of attributes per report configuration evaluated for changes,
+// further attributes count as changed
+#define DD_REPORT_ATTRIBUTES_MAX 8
+
+struct dd_reported_value {
+  bool valid;
+  dd_value_type type;
+  union {
+    bool vbool;
+    double vnumber; // analog types (int,uint,time)
+    uint32_t vhash; // strings are compared by hash
+  } value;
+};
+
+// volatile reporting state of a binding (not persisted)
+struct dd_binding_state {
+  // report configuration the values were reported for
+  uint8_t rid;
+  uint32_t reports_generation;
+
+  // last reported values, by position in report configuration
+  dd_reported_value values[DD_REPORT_ATTRIBUTES_MAX];
+};
+
+// pack resource path /zcl/e/<eid>/<role><cid>/<sub>/<id> into a route key
+#define DD_ROUTE_KEY(eid, role, cid, sub, id)                                  \
+  (((uint64_t)(uint8_t)(eid) << 48) | ((uint64_t)(uint8_t)(role) << 40) |      \
+   ((uint64_t)(uint16_t)(cid) << 24) | ((uint64_t)(uint8_t)(sub) << 16) |      \
+   (uint64_t)(uint16_t)(id))
+struct dd_route {
+  // each route has a unique key, see DD_ROUTE_KEY
+  // - endpoints: (eid, 0, 0, 0, 0)
+  // - clusters: (eid, role, cid, 0, 0)
+  // - attributes and commands: (eid, role, cid, 'a'|'c', id)
+  uint64_t key;
+
+  // resources along the path
+  dd_endpoint *endpoint;
+  dd_cluster *cluster;
+  union {
+    dd_attribute *attribute;
+    dd_command *command;
+  };
+};
+
 enum dd_scheme {
   DD_NONE = 0,
   DD_COAP = 1,
@@ -168,21 +275,13 @@ enum dd_scheme {
 
 struct dd_uri {
   dd_scheme scheme;
-  const char *host;
+  dd_ref host; // see dd_uri_host
   uint16_t port;
-  const char *path;
+  dd_ref path; // see dd_uri_path
   unsigned int length; // number of bytes appended in _buffer
   char _buffer[];
 };
 
-enum dd_value_type {
-  DD_BOOL,
-  DD_INT,
-  DD_UINT,
-  DD_TIME,
-  DD_STRING,
-};
-
 struct dd_value {
   dd_value_type type;  // base data type
   unsigned int length; // number of bytes appended in _buffer
@@ -192,13 +291,78 @@ struct dd_value {
     int64_t vint;
     uint64_t vuint;
     time_t vtime;
-    const char *vstring;
+    dd_ref vstring; // see dd_value_to_string
   } value;
   char _buffer[]; // storage for dynamic size values (string)
 };
 
 extern dd_device *__device; // root of ZCL Resource Tree
 
+/*
+ * look-up resources by identifier
+ *
+ * returns:
+ * -  0 if not found
+ * -  pointer to resource
+ */
+dd_route *dd_find_route(dd_device *device, uint64_t key);
+dd_attribute *dd_find_attribute(dd_cluster *cluster, uint16_t aid);
+dd_binding *dd_find_binding(dd_cluster *cluster, uint8_t bid);
+dd_report *dd_find_report(dd_cluster *cluster, uint8_t rid);
+
+/*
+ * add or remove dynamic resources, keeping cluster tables sorted by id
+ *
+ * returns -1 if table is full, 0 otherwise
+ */
+int dd_insert_binding(dd_cluster *cluster, dd_binding *binding);
+void dd_remove_binding(dd_cluster *cluster, dd_binding *binding);
+int dd_insert_report(dd_cluster *cluster, dd_report *report);
+void dd_remove_report(dd_cluster *cluster, dd_report *report);
+
+/*
+ * direct links, resolved when records are inserted into resource tree
+ *
+ * Note: call dd_link_binding after updating a binding in place.
+ *
+ * returns:
+ * -  0 if binding references no existing report configuration
+ * -  report configuration of binding, or attribute configured at index of
+ *    report
+ */
+void dd_link_binding(dd_cluster *cluster, dd_binding *binding);
+dd_report *dd_binding_report(dd_binding *binding);
+dd_attribute *dd_report_attribute_link(dd_cluster *cluster, dd_report *report,
+                                       size_t index,
+                                       dd_report_attribute *configuration);
+
+/*
+ * resolve or set self-relative reference
+ *
+ * Note: target must lie within the record holding the reference, so that both
+ * move together.
+ *
+ * returns:
+ * -  0 if reference is unset
+ * -  pointer to target
+ */
+void *dd_ref_get(const dd_ref *ref);
+void dd_ref_set(dd_ref *ref, const void *target);
+
+/*
+ * typed accessors for references of persisted records
+ */
+dd_uri *dd_binding_uri(const dd_binding *binding);
+const char *dd_uri_host(const dd_uri *uri);
+const char *dd_uri_path(const dd_uri *uri);
+
+/*
+ * copy records, these hold no absolute pointers and copy in one piece
+ *
+ * returns:
+ * -  0 if destination is too small
+ * -  destination
+ */
 dd_binding *dd_copy_binding(void *destination, size_t destination_size,
                             dd_binding *source);
 dd_report *dd_copy_report(void *destination, size_t destination_size,
@@ -210,6 +374,19 @@ dd_uri *dd_copy_uri(void *destination, size_t destination_size, dd_uri *source);
 dd_value *dd_copy_value(void *destination, size_t destination_size,
                         dd_value *source);
 
+/*
+ * compare scheme, host, port and path of two uris
+ */
+bool dd_uri_equals(const dd_uri *a, const dd_uri *b);
+
+dd_report_attribute *dd_report_attribute_next(dd_report *report,
+                                              dd_report_attribute *current);
+
+void dd_attribute_changed(dd_attribute *attribute, dd_value *value);
+dd_value *dd_attribute_read(dd_attribute *attribute, void *buffer,
+                            size_t buffer_size);
+void dd_attribute_write(dd_attribute *attribute, dd_value *value);
+
 bool dd_value_to_bool(dd_value *value);
 dd_value *dd_bool_to_value(bool vbool, void *buffer, size_t buffer_size);
 